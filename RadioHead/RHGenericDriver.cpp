@@ -104,12 +104,23 @@ bool RHGenericDriver::waitCAD()
     return true;
 }
 
+bool RHGenericDriver::sendReply(const uint8_t* data, uint8_t len)
+{
+    return send(data, len);
+}
+
 // subclasses are expected to override if CAD is available for that radio
 bool RHGenericDriver::isChannelActive()
 {
     return false;
 }
 
+uint32_t RHGenericDriver::timeOnAir(uint8_t len)
+{
+    (void)len; // Not used
+    return 0;
+}
+
 void RHGenericDriver::setPromiscuous(bool promiscuous)
 {
     _promiscuous = promiscuous;
@@ -166,6 +177,11 @@ int16_t RHGenericDriver::lastRssi()
     return _lastRssi;
 }
 
+int RHGenericDriver::lastSNR()
+{
+    return 0;
+}
+
 RHGenericDriver::RHMode  RHGenericDriver::mode()
 {
     return _mode;
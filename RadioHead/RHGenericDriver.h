@@ -160,6 +160,22 @@ public:
     /// current radio channel as active, else false. If there is no radio-specific CAD, returns false.
     virtual bool            isChannelActive();
 
+    /// Returns the time it takes to transmit a message with the current modulation settings.
+    /// This is expected to be subclassed by radios that can compute it. If the radio does not
+    /// support it, returns 0. Protocol timeouts can add this to allow for slow modulations.
+    /// \param[in] len Number of octets that would be passed to send()
+    /// \return Time on air in milliseconds, including any headers the driver adds, or 0 if unknown.
+    virtual uint32_t        timeOnAir(uint8_t len);
+
+    /// Sends a short reply, such as an acknowledgement, to a node that is listening for it
+    /// straight after its message was received. The channel was just heard carrying that message
+    /// and the node is waiting, so radios may skip waitCAD() and start the transmitter as soon
+    /// as the frame is loaded. Otherwise the same as send(), which it calls by default.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send (> 0)
+    /// \return true if the message length was valid and it was correctly queued for transmit
+    virtual bool            sendReply(const uint8_t* data, uint8_t len);
+
     /// Sets the address of this node. Defaults to 0xFF. Subclasses or the user may want to change this.
     /// This will be used to test the adddress in incoming messages. In non-promiscuous mode,
     /// only messages with a TO header the same as thisAddress or the broadcast addess (0xFF) will be accepted.
@@ -219,6 +235,11 @@ public:
     /// \return The most recent RSSI measurement in dBm.
     virtual int16_t        lastRssi();
 
+    /// Returns the Signal-to-noise ratio (SNR) of the last received message.
+    /// This is expected to be subclassed by radios that measure it. If the radio does not, returns 0.
+    /// \return SNR of the last received message in dB, or 0 if unknown
+    virtual int            lastSNR();
+
     /// Returns the operating mode of the library.
     /// \return the current mode, one of RF69_MODE_*
     virtual RHMode          mode();
@@ -13,13 +13,30 @@
 
 #include <RHMesh.h>
 
-uint8_t RHMesh::_tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
+// Adds a link cost to a path cost, stopping at 255
+static uint8_t addCost(uint8_t cost, uint8_t link)
+{
+    uint16_t sum = (uint16_t)cost + link;
+    return sum > 255 ? 255 : sum;
+}
 
 ////////////////////////////////////////////////////////////////////
 // Constructors
 RHMesh::RHMesh(RHGenericDriver& driver, uint8_t thisAddress) 
     : RHRouter(driver, thisAddress)
 {
+    _arpTimeout = RH_MESH_ARP_TIMEOUT;
+    setRouteLifetime(RH_MESH_ROUTE_LIFETIME);
+#if RH_ENABLE_RELIABLE_WINDOW
+    memset(_async, 0, sizeof(_async));
+    _lastAsyncHandle = 0;
+    _sendCallback = NULL;
+#endif
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    for (uint8_t i = 0; i < RH_MESH_PATH_CACHE_LEN; i++)
+	_paths[i].dest = RH_BROADCAST_ADDRESS;
+    _sourceRouting = false;
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -38,46 +55,389 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
 	RoutingTableEntry* route = getRouteTo(address);
 	if (!route && !doArp(address))
 	    return RH_ROUTER_ERROR_NO_ROUTE;
+	refreshRoute(address);
     }
 
     // Now have a route. Contruct an application layer message and send it via that route
-    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+    return RHRouter::sendtoWait(_tmpMessage.data, buildApplicationMessage(buf, len, address), address, flags);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::buildApplicationMessage(uint8_t* buf, uint8_t len, uint8_t dest)
+{
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    MeshPath* path = _sourceRouting && dest != RH_BROADCAST_ADDRESS ? getPathTo(dest) : NULL;
+    if (path && !getRouteTo(dest))
+    {
+	// The route expired or was deleted, the path goes with it
+	forgetPath(dest);
+	path = NULL;
+    }
+    uint16_t sourceRoutedLen = path ? sizeof(RHMesh::MeshMessageHeader) + 2 + path->len + len : 0;
+    if (   path
+	&& sourceRoutedLen <= RH_ROUTER_MAX_MESSAGE_LEN
+	&& sourceRoutedLen + sizeof(RoutedMessageHeader) <= _driver.maxMessageLength())
+    {
+	MeshSourceRoutedMessage* s = (MeshSourceRoutedMessage*)_tmpMessage.data;
+	s->header.msgType = RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED;
+	s->index = 0;
+	s->pathlen = path->len;
+	memcpy(s->path, path->path, path->len);
+	memcpy(s->path + path->len, buf, len);
+	return sourceRoutedLen;
+    }
+    // Else no path, or the path doesnt fit: route it hop by hop
+#endif
+    MeshApplicationMessage* a = (MeshApplicationMessage*)_tmpMessage.data;
     a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
     memcpy(a->data, buf, len);
-    return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
+    return sizeof(RHMesh::MeshMessageHeader) + len;
 }
 
+#if RH_ENABLE_ROUTER_FLOOD
 ////////////////////////////////////////////////////////////////////
-bool RHMesh::doArp(uint8_t address)
+uint8_t RHMesh::sendtoFlood(uint8_t* buf, uint8_t len, uint8_t flags)
+{
+    if (len > RH_MESH_MAX_MESSAGE_LEN)
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+
+    MeshApplicationMessage* a = (MeshApplicationMessage*)_tmpMessage.data;
+    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    memcpy(a->data, buf, len);
+    return RHRouter::sendtoFlood(_tmpMessage.data, sizeof(RHMesh::MeshMessageHeader) + len, flags);
+}
+#endif
+
+#if RH_ENABLE_RELIABLE_WINDOW
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags)
+{
+    if (   len > RH_MESH_MAX_MESSAGE_LEN
+	|| (uint16_t)len + sizeof(RHMesh::MeshMessageHeader) + sizeof(RoutedMessageHeader) > _driver.maxMessageLength())
+	return 0;
+
+    uint8_t i;
+    for (i = 0; i < RH_MESH_ASYNC_QUEUE_LEN; i++)
+	if (_async[i].state == AsyncFree)
+	    break;
+    if (i == RH_MESH_ASYNC_QUEUE_LEN)
+	return 0;
+
+    // Next handle, skipping 0 and any still in use
+    uint8_t handle;
+    bool inUse;
+    do
+    {
+	handle = ++_lastAsyncHandle;
+	inUse = handle == 0;
+	for (uint8_t j = 0; j < RH_MESH_ASYNC_QUEUE_LEN && !inUse; j++)
+	    inUse = _async[j].state != AsyncFree && _async[j].handle == handle;
+    } while (inUse);
+
+    AsyncSend* a = &_async[i];
+    a->state = AsyncQueued;
+    a->handle = handle;
+    a->dest = address;
+    a->flags = flags;
+    a->len = len;
+    memcpy(a->buf, buf, len);
+    return handle;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::poll()
+{
+    uint8_t i;
+    for (i = 0; i < RH_MESH_ASYNC_QUEUE_LEN; i++)
+    {
+	AsyncSend* a = &_async[i];
+	if (a->state == AsyncDiscovering)
+	{
+	    // A reply to the discovery adds the route as it goes past
+	    if (getRouteTo(a->dest))
+		a->state = AsyncQueued;
+	    else if (millis() - a->started > _arpTimeout)
+	    {
+		a->status = RH_ROUTER_ERROR_NO_ROUTE;
+		a->state = AsyncDone;
+	    }
+	}
+	if (a->state != AsyncQueued)
+	    continue;
+
+	if (a->dest != RH_BROADCAST_ADDRESS)
+	    refreshRoute(a->dest);
+	// Contruct an application layer message and send it via the route, if there is one
+	uint8_t len = buildApplicationMessage(a->buf, a->len, a->dest);
+	if (a->dest == RH_BROADCAST_ADDRESS)
+	{
+	    // Broadcasts are not acknowledged, so they are done as soon as they are sent
+	    a->status = RHRouter::sendtoWait(_tmpMessage.data, len, RH_BROADCAST_ADDRESS, a->flags);
+	    a->state = AsyncDone;
+	    continue;
+	}
+	uint8_t error = sendtoFromSourceWindow(_tmpMessage.data, len, a->dest, _thisAddress, a->flags, &a->next_hop, &a->id);
+	if (error == RH_ROUTER_ERROR_NONE)
+	    a->state = AsyncSending;
+	else if (error == RH_ROUTER_ERROR_NO_ROUTE)
+	{
+	    // Only one discovery at a time for each destination
+	    bool discovering = false;
+	    for (uint8_t j = 0; j < RH_MESH_ASYNC_QUEUE_LEN && !discovering; j++)
+		discovering = _async[j].state == AsyncDiscovering && _async[j].dest == a->dest;
+	    a->state = AsyncDiscovering;
+	    a->started = millis();
+	    if (!discovering)
+		sendArpRequest(a->dest);
+	}
+	else if (error != RH_ROUTER_ERROR_QUEUE_FULL)
+	{
+	    a->status = error;
+	    a->state = AsyncDone;
+	}
+	// Else the window to the next hop is full, try again next time
+    }
+
+    pollWindow();
+
+    // Report what has finished. Free the entry first, so the callback can queue another message
+    for (i = 0; i < RH_MESH_ASYNC_QUEUE_LEN; i++)
+    {
+	AsyncSend* a = &_async[i];
+	if (a->state == AsyncDone)
+	{
+	    a->state = AsyncFree;
+	    if (_sendCallback)
+		_sendCallback(a->handle, a->status);
+	}
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::setSendCallback(SendCallback callback)
+{
+    _sendCallback = callback;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::asyncPending()
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < RH_MESH_ASYNC_QUEUE_LEN; i++)
+	if (_async[i].state != AsyncFree)
+	    count++;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////
+// Called by RHReliableDatagram as each windowed message is acknowledged or dropped
+void RHMesh::windowDone(uint8_t address, uint8_t id, bool delivered)
+{
+#if RH_ENABLE_ROUTER_QUEUE
+    RHRouter::windowDone(address, id, delivered);
+#endif
+    for (uint8_t i = 0; i < RH_MESH_ASYNC_QUEUE_LEN; i++)
+    {
+	AsyncSend* a = &_async[i];
+	if (a->state == AsyncSending && a->next_hop == address && a->id == id)
+	{
+	    if (delivered)
+		a->status = RH_ROUTER_ERROR_NONE;
+	    else
+	    {
+		// Cant deliver to the next hop. Delete the route, as route() does
+		deleteRouteTo(a->dest);
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+		forgetPath(a->dest);
+#endif
+		a->status = RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
+	    }
+	    a->state = AsyncDone;
+	    return;
+	}
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::sendArpRequest(uint8_t address)
 {
-    // Need to discover a route
     // Broadcast a route discovery message with nothing in it
-    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)_tmpMessage.data;
     p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST;
     p->destlen = 1; 
     p->dest = address; // Who we are looking for
-    uint8_t error = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 2, RH_BROADCAST_ADDRESS);
-    if (error !=  RH_ROUTER_ERROR_NONE)
+    p->cost = 0;
+    return RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 3, RH_BROADCAST_ADDRESS) == RH_ROUTER_ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::setArpTimeout(uint16_t timeout)
+{
+    _arpTimeout = timeout;
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHMesh::arpTimeout()
+{
+    return _arpTimeout;
+}
+
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+////////////////////////////////////////////////////////////////////
+void RHMesh::setSourceRouting(bool on)
+{
+    _sourceRouting = on;
+}
+
+////////////////////////////////////////////////////////////////////
+RHMesh::MeshSourceRoutedMessage* RHMesh::sourceRouted(RoutedMessage* message, uint8_t messageLen)
+{
+    MeshSourceRoutedMessage* s = (MeshSourceRoutedMessage*)message->data;
+    if (   messageLen < sizeof(RoutedMessageHeader) + sizeof(MeshMessageHeader) + 2
+	|| s->header.msgType != RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED
+	|| s->pathlen > messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 2)
+	return NULL;
+    return s;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::stripPath(RoutedMessage* message, uint8_t messageLen)
+{
+    MeshSourceRoutedMessage* s = (MeshSourceRoutedMessage*)message->data;
+    MeshApplicationMessage* a = (MeshApplicationMessage*)message->data;
+    uint8_t pathOctets = 2 + s->pathlen; // index, pathlen and path
+    uint8_t dataLen = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - pathOctets;
+    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    memmove(a->data, s->path + s->pathlen, dataLen);
+    return messageLen - pathOctets;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::sourceRouteFailed(RoutedMessage* message, uint8_t* messageLen)
+{
+    MeshSourceRoutedMessage* s = sourceRouted(message, *messageLen);
+    if (!s)
+	return false;
+    if (message->header.source == _thisAddress)
+	forgetPath(message->header.dest);
+    // Fall back to our own route, unless it goes the way that just failed
+    uint8_t failed = s->index < s->pathlen ? s->path[s->index] : message->header.dest;
+    RoutingTableEntry* route = getRouteTo(message->header.dest);
+    if (!route || route->next_hop == failed)
 	return false;
+    *messageLen = stripPath(message, *messageLen);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::learnPath(uint8_t dest, uint8_t* path, uint8_t len, uint8_t cost)
+{
+    MeshPath* p = getPathTo(dest);
+    bool current = p && (uint32_t)(millis() - p->learned) < _arpTimeout; // From this discovery
+    if (len > RH_MESH_MAX_PATH)
+    {
+	// Too long to carry, so route it hop by hop rather than by a path from an earlier discovery
+	if (p && !current)
+	    forgetPath(dest);
+	return;
+    }
+    if (current && p->cost <= cost)
+	return; // Already have a path at least as good from this discovery
+    if (!p)
+    {
+	// A free entry, else the oldest
+	p = &_paths[0];
+	for (uint8_t i = 0; i < RH_MESH_PATH_CACHE_LEN; i++)
+	{
+	    if (_paths[i].dest == RH_BROADCAST_ADDRESS)
+	    {
+		p = &_paths[i];
+		break;
+	    }
+	    if ((long)(_paths[i].learned - p->learned) < 0)
+		p = &_paths[i];
+	}
+    }
+    p->dest = dest;
+    p->cost = cost;
+    p->len = len;
+    p->learned = millis();
+    memcpy(p->path, path, len);
+}
+
+////////////////////////////////////////////////////////////////////
+RHMesh::MeshPath* RHMesh::getPathTo(uint8_t dest)
+{
+    for (uint8_t i = 0; i < RH_MESH_PATH_CACHE_LEN; i++)
+	if (_paths[i].dest == dest)
+	    return &_paths[i];
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::forgetPath(uint8_t dest)
+{
+    MeshPath* p = getPathTo(dest);
+    if (p)
+	p->dest = RH_BROADCAST_ADDRESS;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::refreshRoute(uint8_t address)
+{
+    RoutingTableEntry* route = getRouteTo(address);
+    uint32_t lifetime = routeLifetime();
+    if (   route
+	&& route->state == Valid
+	&& lifetime
+	&& (uint32_t)(millis() - route->lastHeard) >= lifetime - lifetime / 4)
+    {
+	// Rediscover it in the background. The reply replaces it as it goes past peekAtMessage()
+	route->state = Discovering;
+	sendArpRequest(address);
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::learnRoute(uint8_t dest, uint8_t next_hop, uint8_t cost)
+{
+    RoutingTableEntry* route = getRouteTo(dest);
+    if (   route
+	&& route->next_hop != next_hop
+	&& route->cost != 0
+	&& route->cost <= cost
+	&& (uint32_t)(millis() - route->lastHeard) < _arpTimeout)
+	return; // Already have a route at least as good from this discovery
+    addRouteTo(dest, next_hop, Valid, cost);
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::doArp(uint8_t address)
+{
+    // Need to discover a route
+    if (!sendArpRequest(address))
+	return false;
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)_tmpMessage.data;
     
     // Wait for a reply, which will be unicast back to us
     // It will contain the complete route to the destination
-    uint8_t messageLen = sizeof(_tmpMessage);
-    // FIXME: timeout should be configurable
+    uint8_t messageLen = sizeof(_tmpMessage.data);
     unsigned long starttime = millis();
     int32_t timeLeft;
-    while ((timeLeft = RH_MESH_ARP_TIMEOUT - (millis() - starttime)) > 0)
+    while ((timeLeft = _arpTimeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	if (available() || waitAvailableTimeout(forwardWait(floodWait(ackWait(timeLeft)))))
 	{
-	    if (RHRouter::recvfromAck(_tmpMessage, &messageLen))
+	    if (RHRouter::recvfromAck(_tmpMessage.data, &messageLen))
 	    {
 		if (   messageLen > 1
-		       && p->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE)
+		       && p->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
+		       && getRouteTo(address))
 		{
-		    // Got a reply, now add the next hop to the dest to the routing table
-		    // The first hop taken is the first octet
-		    addRouteTo(address, headerFrom());
+		    // Got a reply, and peekAtMessage() added the next hop to the dest to the routing table
+		    // Any later replies by cheaper paths replace it as they arrive
 		    return true;
 		}
 	    }
@@ -99,23 +459,52 @@ void RHMesh::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 	// being routed back to the originator here. Want to scrape some routing data out of the response
 	// We can find the routes to all the nodes between here and the responding node
 	MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)message->data;
-	addRouteTo(d->dest, headerFrom());
-	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 2;
+	// Add the link to the node it came from, making it the cost from here to the responding node.
+	// The message is routed on from this buffer, so the next node gets the new cost.
+	d->cost = addCost(d->cost, linkCost(headerFrom()));
+	learnRoute(d->dest, headerFrom(), d->cost);
+	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 3;
 	uint8_t i;
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+	// The list is the whole path from the originator to the responding node. Keep it only if the
+	// reply came back along it, so the cost is that of the path. nextHop() sends it that way, but
+	// a node without RH_ENABLE_MESH_SOURCE_ROUTE routes it by its own routing table
+	if (   message->header.dest == _thisAddress
+	    && headerFrom() == (numRoutes ? d->route[0] : d->dest))
+	    learnPath(d->dest, d->route, numRoutes, d->cost);
+#endif
 	// Find us in the list of nodes that were traversed to get to the responding node
 	for (i = 0; i < numRoutes; i++)
 	    if (d->route[i] == _thisAddress)
 		break;
 	i++;
+	// The nodes in between are no further than the responding node
 	while (i < numRoutes)
-	    addRouteTo(d->route[i++], headerFrom());
+	    learnRoute(d->route[i++], headerFrom(), d->cost);
     }
     else if (   messageLen > 1 
 	     && m->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE)
     {
 	MeshRouteFailureMessage* d = (MeshRouteFailureMessage*)message->data;
 	deleteRouteTo(d->dest);
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+	forgetPath(d->dest);
+#endif
     }
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    else if (message->header.dest != _thisAddress)
+    {
+	// Passing through, so we are the next node in the path
+	MeshSourceRoutedMessage* s = sourceRouted(message, messageLen);
+	if (s && s->index < s->pathlen && s->path[s->index] == _thisAddress)
+	{
+	    s->index++;
+	    // Keep a way back to the source, for route failures
+	    if (!getRouteTo(message->header.source))
+		addRouteTo(message->header.source, headerFrom());
+	}
+    }
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -124,6 +513,11 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
 {
     uint8_t from = headerFrom(); // Might get clobbered during call to superclass route()
     uint8_t ret = RHRouter::route(message, messageLen);
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    if (   ret == RH_ROUTER_ERROR_UNABLE_TO_DELIVER
+	&& sourceRouteFailed(message, &messageLen))
+	ret = RHRouter::route(message, messageLen);
+#endif
     if (   ret == RH_ROUTER_ERROR_NO_ROUTE
 	|| ret == RH_ROUTER_ERROR_UNABLE_TO_DELIVER)
     {
@@ -132,7 +526,7 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
 	if (message->header.source != _thisAddress)
 	{
 	    // This is being proxied, so tell the originator about it
-	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)&_tmpMessage;
+	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)_tmpMessage.data;
 	    p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE;
 	    p->dest = message->header.dest; // Who you were trying to deliver to
 	    // Make sure there is a route back towards whoever sent the original message
@@ -143,6 +537,83 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
     return ret;
 }
 
+////////////////////////////////////////////////////////////////////
+bool RHMesh::nextHop(RoutedMessage* message, uint8_t messageLen, uint8_t* next_hop)
+{
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    MeshSourceRoutedMessage* s = sourceRouted(message, messageLen);
+    if (s)
+    {
+	// Follow the path, without the routing table
+	*next_hop = s->index < s->pathlen ? s->path[s->index] : message->header.dest;
+	return true;
+    }
+    MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)message->data;
+    if (   messageLen >= sizeof(RoutedMessageHeader) + sizeof(MeshMessageHeader) + 3
+	&& d->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE)
+    {
+	// Back along the path the request took, so the cost the reply adds up is the cost of the
+	// path it lists. The responding node is not in the list and sends to the last node in it
+	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 3;
+	uint8_t i;
+	for (i = 0; i < numRoutes && d->route[i] != _thisAddress; i++)
+	    ;
+	if (i < numRoutes || message->header.source == _thisAddress)
+	{
+	    *next_hop = i > 0 ? d->route[i - 1] : message->header.dest;
+	    return true;
+	}
+    }
+#endif
+    return RHRouter::nextHop(message, messageLen, next_hop);
+}
+
+#if RH_ENABLE_ROUTER_QUEUE
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::forwardPriority(RoutedMessage* message, uint8_t messageLen)
+{
+    MeshMessageHeader* m = (MeshMessageHeader*)message->data;
+    if (   messageLen > sizeof(RoutedMessageHeader)
+	&& m->msgType != RH_MESH_MESSAGE_TYPE_APPLICATION
+	&& m->msgType != RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED)
+	return RH_ROUTER_PRIORITY_CONTROL;
+    return RH_ROUTER_PRIORITY_NORMAL;
+}
+
+////////////////////////////////////////////////////////////////////
+// Called when a message being forwarded could not be delivered to the next hop
+void RHMesh::forwardFailed(RoutedMessage* message, uint8_t messageLen, uint8_t from)
+{
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    if (sourceRouteFailed(message, &messageLen))
+    {
+	forward(message, messageLen, from);
+	return;
+    }
+#else
+    (void)messageLen; // Not used
+#endif
+    // Cant deliver to the next hop. Delete the route
+    deleteRouteTo(message->header.dest);
+    if (message->header.source != _thisAddress)
+    {
+	// Tell the originator about it, without waiting for the message to go
+	RoutedMessage failure;
+	failure.header.dest = message->header.source;
+	failure.header.source = _thisAddress;
+	failure.header.hops = 0;
+	failure.header.id = _lastE2ESequenceNumber++;
+	failure.header.flags = 0;
+	MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)failure.data;
+	p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE;
+	p->dest = message->header.dest; // Who you were trying to deliver to
+	// Make sure there is a route back towards whoever sent the original message
+	addRouteTo(message->header.source, from);
+	forward(&failure, sizeof(RoutedMessageHeader) + sizeof(RHMesh::MeshMessageHeader) + 1, _thisAddress);
+    }
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////
 // Subclasses may want to override
 bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
@@ -154,30 +625,45 @@ bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags, uint8_t* hops)
 {     
-    uint8_t tmpMessageLen = sizeof(_tmpMessage);
+    uint8_t tmpMessageLen = sizeof(_tmpMessage.data);
     uint8_t _source;
     uint8_t _dest;
     uint8_t _id;
     uint8_t _flags;
     uint8_t _hops;
-    if (RHRouter::recvfromAck(_tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags, &_hops))
+    if (RHRouter::recvfromAck(_tmpMessage.data, &tmpMessageLen, &_source, &_dest, &_id, &_flags, &_hops))
     {
-	MeshMessageHeader* p = (MeshMessageHeader*)&_tmpMessage;
+	MeshMessageHeader* p = (MeshMessageHeader*)_tmpMessage.data;
+	uint8_t* data = NULL;
+	uint8_t msgLen = 0;
 
 	if (   tmpMessageLen >= 1 
 	    && p->msgType == RH_MESH_MESSAGE_TYPE_APPLICATION)
 	{
-	    MeshApplicationMessage* a = (MeshApplicationMessage*)p;
+	    data = ((MeshApplicationMessage*)p)->data;
+	    msgLen = tmpMessageLen - sizeof(MeshMessageHeader);
+	}
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+	MeshSourceRoutedMessage* s = sourceRouted(&_tmpMessage, sizeof(RoutedMessageHeader) + tmpMessageLen);
+	if (s)
+	{
+	    // At the end of its path. The application data follows the path
+	    data = s->path + s->pathlen;
+	    msgLen = tmpMessageLen - sizeof(MeshMessageHeader) - 2 - s->pathlen;
+	}
+#endif
+
+	if (data)
+	{
 	    // Handle application layer messages, presumably for our caller
 	    if (source) *source = _source;
 	    if (dest)   *dest   = _dest;
 	    if (id)     *id     = _id;
 	    if (flags)  *flags  = _flags;
 	    if (hops)   *hops   = _hops;
-	    uint8_t msgLen = tmpMessageLen - sizeof(MeshMessageHeader);
 	    if (*len > msgLen)
 		*len = msgLen;
-	    memcpy(buf, a->data, *len);
+	    memcpy(buf, data, *len);
 	    
 	    return true;
 	}
@@ -191,23 +677,29 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 	    // If it originally came from us, ignore it
 	    if (_source == _thisAddress)
 		return false;
+#if RH_ENABLE_ROUTER_FLOOD
+	    // Every copy counts towards suppressing our rebroadcast, but only the first is rebroadcast
+	    bool seen = broadcastSeen(_source, _id);
+#endif
 	    
-	    uint8_t numRoutes = tmpMessageLen - sizeof(MeshMessageHeader) - 2;
+	    uint8_t numRoutes = tmpMessageLen - sizeof(MeshMessageHeader) - 3;
 	    uint8_t i;
 	    // Are we already mentioned?
 	    for (i = 0; i < numRoutes; i++)
 		if (d->route[i] == _thisAddress)
 		    return false; // Already been through us. Discard
 	    
+	    // Add the link to the node it came from, making it the cost from here back to the originator
+	    d->cost = addCost(d->cost, linkCost(headerFrom()));
 	        
-            addRouteTo(_source, headerFrom()); // The originator needs to be added regardless of node type
+            learnRoute(_source, headerFrom(), d->cost); // The originator needs to be added regardless of node type
 
-	    // Hasnt been past us yet, record routes back to the earlier nodes
+	    // Hasnt been past us yet, record routes back to the earlier nodes, which are no further
             // No need to waste memory if we are not participating in routing
             if (_isa_router)
             {
 	        for (i = 0; i < numRoutes; i++)
-		    addRouteTo(d->route[i], headerFrom());
+		    learnRoute(d->route[i], headerFrom(), d->cost);
             }
 
 	    if (isPhysicalAddress(&d->dest, d->destlen))
@@ -216,6 +708,8 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 		// as a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
 		// We are certain to have a route there, because we just got it
 		d->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE;
+		// The reply adds up the cost of the path back here afresh
+		d->cost = 0;
 		RHRouter::sendtoWait((uint8_t*)d, tmpMessageLen, _source);
 	    }
 	    else if ((i < _max_hops) && _isa_router)
@@ -223,9 +717,20 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 		// Its for someone else, rebroadcast it, after adding ourselves to the list
 		d->route[numRoutes] = _thisAddress;
 		tmpMessageLen++;
+#if RH_ENABLE_ROUTER_FLOOD
+		// After a random delay, with the originator's SOURCE and ID so the neighbours know
+		// the copies for the same request. Skipped if enough neighbours rebroadcast it first,
+		// unless we know a route to the dest: we may be the only way there
+		if (!seen)
+		{
+		    RoutingTableEntry* route = getRouteTo(d->dest);
+		    rebroadcastLater(&_tmpMessage, sizeof(RoutedMessageHeader) + tmpMessageLen, !(route && route->state == Valid));
+		}
+#else
 		// Have to impersonate the source
 		// REVISIT: if this fails what can we do?
-		RHRouter::sendtoFromSourceWait(_tmpMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
+		RHRouter::sendtoFromSourceWait(_tmpMessage.data, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
+#endif
 	    }
 	}
     }
@@ -239,7 +744,7 @@ bool RHMesh::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout, ui
     int32_t timeLeft;
     while ((timeLeft = timeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	if (available() || waitAvailableTimeout(forwardWait(floodWait(ackWait(timeLeft)))))
 	{
 	    if (recvfromAck(buf, len, from, to, id, flags, hops))
 		return true;
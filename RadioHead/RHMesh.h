@@ -14,10 +14,44 @@
 #define RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST        1
 #define RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE       2
 #define RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE                  3
+#define RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED                  4
 
-// Timeout for address resolution in milliecs
+// Default timeout for address resolution in milliecs. See RHMesh::setArpTimeout()
 #define RH_MESH_ARP_TIMEOUT 4000
 
+// Default lifetime of discovered routes in millisecs. See RHMesh::setRouteLifetime()
+#ifndef RH_MESH_ROUTE_LIFETIME
+#define RH_MESH_ROUTE_LIFETIME 300000
+#endif
+
+// Number of messages sendtoAsync() can hold until they are delivered to the next hop or fail
+#ifndef RH_MESH_ASYNC_QUEUE_LEN
+#define RH_MESH_ASYNC_QUEUE_LEN 4
+#endif
+
+// Status passed to the send callback while a message is still in progress. Never reported.
+#define RH_MESH_SEND_PENDING 0xff
+
+// This macro enables source routing, see RHMesh::setSourceRouting(). It needs RH_MESH_PATH_CACHE_LEN
+// paths of up to RH_MESH_MAX_PATH octets, so it is off on AVR
+#ifndef RH_ENABLE_MESH_SOURCE_ROUTE
+ #if defined(__AVR__)
+  #define RH_ENABLE_MESH_SOURCE_ROUTE 0
+ #else
+  #define RH_ENABLE_MESH_SOURCE_ROUTE 1
+ #endif
+#endif
+
+// Number of destinations whose discovered paths are kept for source routing
+#ifndef RH_MESH_PATH_CACHE_LEN
+#define RH_MESH_PATH_CACHE_LEN 8
+#endif
+
+// Most intermediate nodes in a source routed path. Longer paths are routed hop by hop
+#ifndef RH_MESH_MAX_PATH
+#define RH_MESH_MAX_PATH 8
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHMesh RHMesh.h <RHMesh.h>
 /// \brief RHRouter subclass for sending addressed, optionally acknowledged datagrams
@@ -49,6 +83,13 @@
 /// If a node receives a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST that already has itself 
 /// listed in the visited nodes, it knows it has already seen and rebroadcast this request, 
 /// and threfore ignores it. This prevents broadcast storms.
+/// With RH_ENABLE_ROUTER_FLOOD (off on AVR), requests are also rebroadcast as floods are (see RHRouter):
+/// each router remembers the SOURCE and ID of the requests it has seen and rebroadcasts each once,
+/// keeping the originator's SOURCE and ID, after a random delay so that its neighbours don't all
+/// transmit at once, and not at all if it hears RHRouter::setFloodCopies() copies of the request while it waits.
+/// A router that already has a route to the requested node always rebroadcasts, as it may be the only way there.
+/// So in a dense cluster a request gets through in one round instead of colliding with itself.
+/// The copies it hears still teach it routes back towards the originator.
 /// When a node receives a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST it can use the list of 
 /// nodes aready visited to deduce routes back towards the originating (requesting node). 
 /// This also means that when the destination node of the request is reached, it (and all 
@@ -65,9 +106,16 @@
 /// RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE together ensure the original requester and all 
 /// the intermediate nodes know how to route to the source and destination nodes and every node along the path.
 ///
-/// Note that there is a race condition here that can effect routing on multipath routes. For example, 
-/// if the route to the destination can traverse several paths, last reply from the destination 
-/// will be the one used.
+/// Requests and replies also carry the cost of the path they have travelled, the sum of the
+/// RHReliableDatagram::linkCost() of each hop: the expected number of transmissions, worked out from
+/// how well each node hears its neighbours and how many of its messages they acknowledge.
+/// Each node adds the cost of the link back to the node it heard the message from, so a request
+/// gives the cost of the path back to the originator and a reply the cost of the path on to the
+/// destination. If the route can traverse several paths, the copies of a request and their replies
+/// arrive by several paths, and while arpTimeout() has not passed since a route was learned it is
+/// only replaced by a cheaper one. So the mesh prefers a path of a few good links to a shorter path
+/// over marginal ones. Older routes are replaced by whatever the next discovery finds.
+/// Every node in the mesh must run a version of RHMesh whose MeshRouteDiscoveryMessage has the cost.
 ///
 /// \par Route Failure
 ///
@@ -84,6 +132,29 @@
 /// (either because an intermediate node is off the air, or has moved out of range) a new route 
 /// will be established the next time a message is to be sent.
 ///
+/// \par Route Expiry
+///
+/// Discovered routes last RH_MESH_ROUTE_LIFETIME (see RHRouter::setRouteLifetime()), so routes to nodes that have
+/// gone away or moved do not linger. When this node sends to a destination whose route has less than a quarter
+/// of its lifetime left, it broadcasts a new route discovery request and carries on using the old route until
+/// the reply replaces it, so routes in use are refreshed before they expire and sends do not wait for discovery.
+/// Replies are received by recvfromAck(), so call it frequently.
+///
+/// \par Source Routing
+///
+/// The RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE that reaches the originator lists every node
+/// the request passed through on its way to the destination. With setSourceRouting() the originator
+/// keeps that path and sends its messages to the destination as MeshSourceRoutedMessage, which carries
+/// the path and the index of the next node in it. Each intermediate node forwards to the next node in the
+/// path, so it needs no route of its own to the destination and does no discovery for it, which helps
+/// with destinations that are rarely sent to. If an intermediate node can't deliver to the next node in
+/// the path, it falls back to its own route to the destination, if it has one, and otherwise tells the
+/// originator with a RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE as usual. The originator forgets the path of a
+/// destination whose route fails or expires, and routes to it hop by hop until the next discovery gives it
+/// a new path. The reply to a discovery goes back along the reverse of the path it lists, so its cost is the
+/// cost of that path, and of the replies to one discovery the path of the cheapest is kept. A path is only kept
+/// if its reply came back that way. Requires RH_ENABLE_MESH_SOURCE_ROUTE, which is off on AVR. Every node on the path must be able to forward RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED.
+///
 /// \par Message Format
 ///
 /// RHMesh uses a number of message formats layered on top of RHRouter:
@@ -94,6 +165,8 @@
 ///   (broadcast) and replies (unicast).
 /// - MeshRouteFailureMessage (message type RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE) Informs nodes of 
 ///   route failures.
+/// - MeshSourceRoutedMessage (message type RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED) Carries an application layer
+///   message along with the path to its destination.
 ///
 /// Part of the Arduino RH library for operating with HopeRF RH compatible transceivers 
 /// (see http://www.hoperf.com)
@@ -108,9 +181,13 @@
 /// (https://lowpowerlab.com/shop/moteinomega) or others.
 ///
 /// \par Performance
-/// This class (in the interests of simple implemtenation and low memory use) does not have
+/// sendtoWait() (in the interests of simple implemtenation and low memory use) does not have
 /// message queueing. This means that only one message at a time can be handled. Message transmission 
 /// failures can have a severe impact on network performance.
+/// Where RH_ENABLE_RELIABLE_WINDOW is available, sendtoAsync() queues up to RH_MESH_ASYNC_QUEUE_LEN
+/// messages instead and returns at once. poll() discovers their routes, sends them through the
+/// RHReliableDatagram window and reports the outcome of each to the callback set with setSendCallback(),
+/// so the application can keep receiving while they are in flight.
 /// If you need high performance mesh networking under all conditions consider XBee or similar.
 class RHMesh : public RHRouter
 {
@@ -138,7 +215,8 @@ public:
 	MeshMessageHeader   header;  ///< msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_*
 	uint8_t             destlen; ///< Reserved. Must be 1
 	uint8_t             dest;    ///< The address of the destination node whose route is being sought
-	uint8_t             route[RH_MESH_MAX_MESSAGE_LEN - 2]; ///< List of node addresses visited so far. Length is implcit
+	uint8_t             cost;    ///< Path cost so far in units of 1/RH_ETX_UNIT transmissions, stopping at 255
+	uint8_t             route[RH_MESH_MAX_MESSAGE_LEN - 3]; ///< List of node addresses visited so far. Length is implcit
     } MeshRouteDiscoveryMessage;
 
     /// Signals a route failure
@@ -148,6 +226,15 @@ public:
 	uint8_t             dest; ///< The address of the destination towards which the route failed
     } MeshRouteFailureMessage;
 
+    /// Signals an application layer message that carries the path to its destination
+    typedef struct
+    {
+	MeshMessageHeader   header;  ///< msgType = RH_MESH_MESSAGE_TYPE_SOURCE_ROUTED
+	uint8_t             index;   ///< Index in path of the next node to send to. When it reaches pathlen, the next node is the DEST
+	uint8_t             pathlen; ///< Number of node addresses in path
+	uint8_t             path[RH_MESH_MAX_MESSAGE_LEN - 2]; ///< The intermediate nodes from the source to the DEST, then the application layer payload data
+    } MeshSourceRoutedMessage;
+
     /// Constructor. 
     /// \param[in] driver The RadioHead driver to use to transport messages.
     /// \param[in] thisAddress The address to assign to this node. Defaults to 0
@@ -156,14 +243,16 @@ public:
     /// Sends a message to the destination node. Initialises the RHRouter message header 
     /// (the SOURCE address is set to the address of this node, HOPS to 0) and calls 
     /// route() which looks up in the routing table the next hop to deliver to.
-    /// If no route is known, initiates route discovery and waits for a reply.
+    /// If no route is known, initiates route discovery and waits for a reply, up to arpTimeout().
+    /// sendtoAsync() queues the message instead of waiting.
+    /// If the route is due to be refreshed, broadcasts a route discovery request without waiting.
     /// Then sends the message to the next hop
     /// Then waits for an acknowledgement from the next hop 
     /// (but not from the destination node (if that is different).
     /// \param [in] buf The application message data
     /// \param [in] len Number of octets in the application message data. 0 is permitted
     /// \param [in] dest The destination node address. If the address is RH_BROADCAST_ADDRESS (255)
-    /// the message will be broadcast to all the nearby nodes, but not routed or relayed.
+    /// the message will be broadcast to all the nearby nodes, but not routed or relayed. sendtoFlood() reaches the whole mesh.
     /// \param [in] flags Optional flags for use by subclasses or application layer, 
     ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
     /// \return The result code:
@@ -174,6 +263,76 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+#if RH_ENABLE_ROUTER_FLOOD
+    /// Floods an application message to every node in the mesh within max_hops, as RHRouter::sendtoFlood().
+    /// No route discovery is needed. The receivers get it from recvfromAck() once each.
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end. Must not include RH_ROUTER_FLAGS_FLOOD.
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE Message was broadcast
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH Message is too long
+    ///         - RH_ROUTER_ERROR_UNABLE_TO_DELIVER Message could not be transmitted
+    uint8_t sendtoFlood(uint8_t* buf, uint8_t len, uint8_t flags = 0);
+#endif
+
+    /// Sets how long sendtoWait() waits for a reply to route discovery, and how long poll() waits before
+    /// failing a sendtoAsync() message with RH_ROUTER_ERROR_NO_ROUTE. Defaults to RH_MESH_ARP_TIMEOUT.
+    /// Slow modulations and large meshes may need longer.
+    /// \param [in] timeout The timeout in milliseconds
+    void setArpTimeout(uint16_t timeout);
+
+    /// Returns the route discovery timeout set by setArpTimeout()
+    /// \return The timeout in milliseconds
+    uint16_t arpTimeout();
+
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    /// Turns source routing on or off for the messages sent by sendtoWait() and sendtoAsync(), see
+    /// "Source Routing" above. When on, a message to a destination whose path was learned from route
+    /// discovery carries the path. This node forwards source routed messages either way. Default is off.
+    /// \param [in] on true to send source routed messages
+    void setSourceRouting(bool on);
+#endif
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Function called by poll() when a message queued by sendtoAsync() is finished with
+    /// \param[in] handle The handle sendtoAsync() returned for the message
+    /// \param[in] status The result code:
+    ///         - RH_ROUTER_ERROR_NONE Message was delivered to the next hop 
+    ///           (not necessarily to the final dest address)
+    ///         - RH_ROUTER_ERROR_NO_ROUTE Route discovery for dest got no reply within arpTimeout()
+    ///         - RH_ROUTER_ERROR_UNABLE_TO_DELIVER The next hop did not acknowledge. The route has been deleted.
+    typedef void (*SendCallback)(uint8_t handle, uint8_t status);
+
+    /// Queues a message for the destination node and returns at once, without waiting for
+    /// route discovery, transmission or acknowledgement as sendtoWait() does.
+    /// Call poll() frequently, with recvfromAck(), to make progress: the result is reported to the
+    /// callback set by setSendCallback(). Messages to RH_BROADCAST_ADDRESS are broadcast by the next poll().
+    /// \param [in] buf The application message data. It is copied, so may be reused at once
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end to the dest address. The receiver can recover the flags with recvFromAck().
+    /// \return A handle for the message, 1 to 255, passed to the callback when it is finished with.
+    /// 0 if the message is too long for the driver or RH_MESH_ASYNC_QUEUE_LEN messages are already in progress.
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
+
+    /// Makes progress on the messages queued by sendtoAsync(). Starts route discovery for those
+    /// with no route and gives up on it after arpTimeout(), refreshes routes that are due, queues the routed ones with
+    /// the next hop, transmits them with RHReliableDatagram::pollWindow(), and calls the send
+    /// callback for every message that has been delivered to the next hop or failed.
+    /// Replies to route discovery and ACKs are received by recvfromAck(), so call both frequently.
+    void poll();
+
+    /// Sets the function poll() calls as each message queued by sendtoAsync() is finished with
+    /// \param[in] callback The function to call, or NULL for none
+    void setSendCallback(SendCallback callback);
+
+    /// Returns the number of messages queued by sendtoAsync() that are not yet finished with
+    uint8_t asyncPending();
+#endif
+
     /// Starts the receiver if it is not running already, processes and possibly routes any received messages
     /// addressed to other nodes
     /// and delivers any messages addressed to this node.
@@ -230,13 +389,133 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
+    /// Finds the next hop for a message: the next node in the path of a source routed message,
+    /// the previous node in the path listed by a route discovery reply, otherwise the one in the routing table.
+    /// \param [in] message Pointer to the RHRouter message to be sent.
+    /// \param [in] messageLen Length of message in octets
+    /// \param [out] next_hop Set to the address of the next hop
+    /// \return false if there is no route
+    virtual bool nextHop(RoutedMessage* message, uint8_t messageLen, uint8_t* next_hop);
+
     /// Try to resolve a route for the given address. Blocks while discovering the route
-    /// which may take up to 4000 msec.
+    /// which may take up to arpTimeout() msec.
     /// Virtual so subclasses can override.
     /// \param [in] address The physical address to resolve
     /// \return true if the address was resolved and added to the local routing table
     virtual bool doArp(uint8_t address);
 
+    /// Broadcasts a route discovery request for address, without waiting for the reply.
+    /// The reply adds the route when it passes through peekAtMessage().
+    /// \param [in] address The physical address to resolve
+    /// \return true if the request was sent
+    bool sendArpRequest(uint8_t address);
+
+    /// Adds or updates the route to dest learned from route discovery. A route learned less than
+    /// arpTimeout() ago, so most likely from the same discovery, is only replaced by a
+    /// cheaper one, or updated if it has the same next hop. Older routes are always replaced.
+    /// \param [in] dest The destination node address
+    /// \param [in] next_hop The address of the next hop to send messages destined for dest
+    /// \param [in] cost The path cost to dest through next_hop, see RoutingTableEntry
+    void learnRoute(uint8_t dest, uint8_t next_hop, uint8_t cost);
+
+    /// If the route to address has less than a quarter of routeLifetime() left, broadcasts a route
+    /// discovery request for it without waiting for the reply, and marks it Discovering so only one is sent.
+    /// The route is still used until the reply replaces it or it expires.
+    /// \param [in] address The destination about to be sent to
+    void refreshRoute(uint8_t address);
+
+    /// Builds an application layer message to dest in _tmpMessage, source routed if setSourceRouting()
+    /// is on and a path to dest is known and fits, otherwise a MeshApplicationMessage.
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data
+    /// \param [in] dest The destination node address
+    /// \return The length of the RHMesh message in _tmpMessage.data
+    uint8_t buildApplicationMessage(uint8_t* buf, uint8_t len, uint8_t dest);
+
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    /// Returns the source routed message in message, or NULL if it is not one
+    MeshSourceRoutedMessage* sourceRouted(RoutedMessage* message, uint8_t messageLen);
+
+    /// Turns a source routed message into a MeshApplicationMessage in place, to be routed hop by hop
+    /// \param [in] message Pointer to the source routed message
+    /// \param [in] messageLen Length of message in octets
+    /// \return The new length of message
+    uint8_t stripPath(RoutedMessage* message, uint8_t messageLen);
+
+    /// Called when a source routed message could not be delivered to the next node in its path.
+    /// Forgets the path if this node is the source. If the routing table has a route to the DEST by
+    /// another next hop, strips the path and routes the message hop by hop instead.
+    /// \param [in] message Pointer to the source routed message
+    /// \param [in,out] messageLen Length of message in octets, updated if the path is stripped
+    /// \return true if the message was stripped and is to be routed again
+    bool sourceRouteFailed(RoutedMessage* message, uint8_t* messageLen);
+
+    /// A path learned from route discovery
+    typedef struct
+    {
+	uint8_t       dest;        ///< Destination, RH_BROADCAST_ADDRESS if the entry is unused
+	uint8_t       cost;        ///< Cost of the reply that brought the path
+	uint8_t       len;         ///< Number of nodes in path
+	unsigned long learned;     ///< millis() when the path was learned
+	uint8_t       path[RH_MESH_MAX_PATH]; ///< The intermediate nodes, from this node's next hop onwards
+    } MeshPath;
+
+    /// Keeps the path to dest from a route discovery reply. Of the replies to one discovery, the cheapest is kept.
+    /// \param [in] dest The destination that replied
+    /// \param [in] path The nodes between this node and dest
+    /// \param [in] len Number of nodes in path
+    /// \param [in] cost The cost of the reply
+    void learnPath(uint8_t dest, uint8_t* path, uint8_t len, uint8_t cost);
+
+    /// Returns the path kept for dest, or NULL if there is none. The path is only used while
+    /// getRouteTo() has a route to dest, so it expires with the route after routeLifetime().
+    MeshPath* getPathTo(uint8_t dest);
+
+    /// Forgets the path kept for dest, if any
+    void forgetPath(uint8_t dest);
+#endif
+
+#if RH_ENABLE_ROUTER_QUEUE
+    /// Gives route discovery replies and route failures RH_ROUTER_PRIORITY_CONTROL, so they are forwarded
+    /// before application messages
+    virtual uint8_t forwardPriority(RoutedMessage* message, uint8_t messageLen);
+
+    /// Deletes the route that failed and queues a RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE to the
+    /// originator, as route() does when it can't deliver to the next hop
+    virtual void forwardFailed(RoutedMessage* message, uint8_t messageLen, uint8_t from);
+#endif
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Matches the windowed messages queued by poll() to the sendtoAsync() messages they carry,
+    /// and the ones queued by RHRouter::forward() to the forwarding queue
+    virtual void windowDone(uint8_t address, uint8_t id, bool delivered);
+
+    /// States of a message queued by sendtoAsync()
+    typedef enum
+    {
+	AsyncFree = 0,         ///< Entry is unused
+	AsyncQueued,           ///< Waiting to be routed and queued for the next hop
+	AsyncDiscovering,      ///< Waiting for route discovery
+	AsyncSending,          ///< Queued for the next hop, waiting for its ACK
+	AsyncDone              ///< Finished with, waiting to be reported
+    } AsyncState;
+
+    /// A message queued by sendtoAsync()
+    typedef struct
+    {
+	uint8_t       state;       ///< One of AsyncState
+	uint8_t       handle;      ///< Returned by sendtoAsync() and passed to the callback
+	uint8_t       dest;        ///< Final destination
+	uint8_t       flags;       ///< End-to-end flags
+	uint8_t       next_hop;    ///< Next hop the message was queued for, when AsyncSending
+	uint8_t       id;          ///< ID of the message to the next hop, when AsyncSending
+	uint8_t       status;      ///< Result code, when AsyncDone
+	unsigned long started;     ///< millis() when route discovery started, when AsyncDiscovering
+	uint8_t       len;         ///< Number of octets in buf
+	uint8_t       buf[RH_MESH_MAX_MESSAGE_LEN]; ///< The application message
+    } AsyncSend;
+#endif
+
     /// Tests if the given address of length addresslen is indentical to the
     /// physical address of this node.
     /// RHMesh always implements physical addresses as the 1 octet address of the node
@@ -250,8 +529,27 @@ protected:
     virtual bool isPhysicalAddress(uint8_t* address, uint8_t addresslen);
 
 private:
-    /// Temporary message buffer
-    static uint8_t _tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
+    /// How long to wait for a reply to route discovery (milliseconds)
+    uint16_t _arpTimeout;
+
+#if RH_ENABLE_MESH_SOURCE_ROUTE
+    /// Paths learned from route discovery
+    MeshPath _paths[RH_MESH_PATH_CACHE_LEN];
+
+    /// Whether sendtoWait() and sendtoAsync() send source routed messages
+    bool _sourceRouting;
+#endif
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Messages queued by sendtoAsync()
+    AsyncSend _async[RH_MESH_ASYNC_QUEUE_LEN];
+
+    /// The last handle returned by sendtoAsync()
+    uint8_t _lastAsyncHandle;
+
+    /// Called by poll() as each message is finished with
+    SendCallback _sendCallback;
+#endif
 
 };
 
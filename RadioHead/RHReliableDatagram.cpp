@@ -22,7 +22,24 @@ RHReliableDatagram::RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddr
     _lastSequenceNumber = 0;
     _timeout = RH_DEFAULT_TIMEOUT;
     _retries = RH_DEFAULT_RETRIES;
-    memset(_seenIds, 0, sizeof(_seenIds));
+    _ackPolicy = AckImmediate;
+    _ackHoldoff = 0;
+    memset(_rxHighest, 0, sizeof(_rxHighest));
+    memset(_rxBitmap, 0, sizeof(_rxBitmap));
+    memset(_rxKnown, 0, sizeof(_rxKnown));
+#if RH_ENABLE_RELIABLE_WINDOW
+    memset(_window, 0, sizeof(_window));
+    _windowSize = RH_DEFAULT_WINDOW_SIZE;
+    _windowFailures = 0;
+    memset(_pendingAcks, 0, sizeof(_pendingAcks));
+    _held.valid = false;
+#endif
+#if RH_ENABLE_RELIABLE_RTT
+    memset(_roundTrip, 0, sizeof(_roundTrip));
+#endif
+#if RH_ENABLE_LINK_QUALITY
+    memset(_links, 0, sizeof(_links));
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -44,6 +61,43 @@ uint8_t RHReliableDatagram::retries()
     return _retries;
 }
 
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setAckPolicy(AckPolicy policy, uint16_t holdoff)
+{
+    _ackPolicy = policy;
+    _ackHoldoff = holdoff;
+}
+
+////////////////////////////////////////////////////////////////////
+RHReliableDatagram::AckPolicy RHReliableDatagram::ackPolicy()
+{
+    return (AckPolicy)_ackPolicy;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHReliableDatagram::ackHoldoff()
+{
+    switch (_ackPolicy)
+    {
+    case AckHoldoff:
+	return _ackHoldoff;
+    case AckAirtime:
+	return _driver.timeOnAir(RH_RELIABLE_ACK_LEN) >> RH_ACK_AIRTIME_HOLDOFF_SHIFT;
+    default:
+	return 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::available()
+{
+#if RH_ENABLE_RELIABLE_WINDOW
+    if (_held.valid)
+	return true;
+#endif
+    return RHDatagram::available();
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 {
@@ -69,7 +123,7 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
         }
         setHeaderFlags(headerFlagsToSet, headerFlagsToClear);
 	//printf("sending\n");
-	sendto(buf, len, address);
+	sendtoPiggyback(buf, len, address);
 	//printf("sent\n");
 	waitPacketSent();
 	//printf("waited\n");
@@ -81,43 +135,75 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 	    _retransmissions++;
 	unsigned long thisSendTime = millis(); // Timeout does not include original transmit time
 
-	// Compute a new timeout, random between _timeout and _timeout*2
-	// This is to prevent collisions on every retransmit
-	// if 2 nodes try to transmit at the same time
-#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
-	uint16_t timeout = _timeout + (_timeout * (random() & 0xFF) / 256);
-	//uint16_t timeout = 3000;
-	//printf("timeout %d\n", timeout);
-#else
-	uint16_t timeout = _timeout + (_timeout * random(0, 256) / 256);
-	//uint16_t timeout = 1000;
-#endif
+	uint32_t timeout = ackTimeout(address);
 	int32_t timeLeft;
         while ((timeLeft = timeout - (millis() - thisSendTime)) > 0)
 	{
-	    if (waitPacketSent(timeLeft))
+	    if (waitPacketSent(ackWait(timeLeft)))
 	    {
 			//printf("timeleft over\n");
 		uint8_t from, to, id, flags;
-		if (recvfrom(0, 0, &from, &to, &id, &flags)) // Discards the message
+#if RH_ENABLE_RELIABLE_WINDOW
+		// Big enough for a message carrying the ACK with RH_FLAGS_PIGGYBACK
+		uint8_t ack[RH_MAX_MESSAGE_LEN];
+#else
+		uint8_t ack[RH_RELIABLE_ACK_LEN];
+#endif
+		uint8_t acklen = sizeof(ack);
+		if (recvfrom(ack, &acklen, &from, &to, &id, &flags)) // Discards the message
 		{
+		    linkHeard(from);
 		    // Now have a message: is it our ACK?
 		    if (   from == address 
 			   && to == _thisAddress 
 			   && (flags & RH_FLAGS_ACK) 
 			   && (id == thisSequenceNumber))
 		    {
-			// Its the ACK we are waiting for
+			// Its the ACK we are waiting for. Per Karn, a retransmitted message
+			// can't tell which transmission was acknowledged, so only time the first.
+			if (retries == 1)
+			    roundTripMeasured(address, millis() - thisSendTime);
+			linkTransmitted(address, true);
 			printf("return true\n");
 			return true;
 		    }
+#if RH_ENABLE_RELIABLE_WINDOW
+		    else if (to == _thisAddress && (flags & RH_FLAGS_ACK))
+		    {
+			// An ACK for windowed messages
+			windowAck(from, id, ack, acklen);
+		    }
+		    else if (   to == _thisAddress
+			     && (flags & RH_FLAGS_PIGGYBACK)
+			     && acklen >= RH_RELIABLE_PIGGYBACK_LEN)
+		    {
+			// A message carrying an ACK, maybe ours. Keep the message for recvfromAck()
+			bool acked = takePiggyback(from, ack, &acklen, &flags, thisSequenceNumber) && from == address;
+			holdMessage(from, to, id, flags, ack, acklen);
+			if (acked)
+			{
+			    if (retries == 1)
+				roundTripMeasured(address, millis() - thisSendTime);
+			    linkTransmitted(address, true);
+			    return true;
+			}
+		    }
+#endif
 		    else if (   !(flags & RH_FLAGS_ACK)
-				&& (id == _seenIds[from]))
+				&& alreadyReceived(from, id, flags))
 		    {
 			// This is a request we have already received. ACK it again
-			delay(10000);
-			acknowledge(id, from);
+			scheduleAck(id, from);
+		    }
+#if RH_ENABLE_RELIABLE_WINDOW
+		    else if (   !(flags & RH_FLAGS_ACK)
+			     && to == _thisAddress)
+		    {
+			// A new message for us, maybe from a node that is waiting for our ACK
+			// just as we wait for its. Keep it for recvfromAck()
+			holdMessage(from, to, id, flags, ack, acklen);
 		    }
+#endif
 		    // Else discard it
 		}
 	    }
@@ -125,6 +211,8 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 	    YIELD;
 	}
 	// Timeout exhausted, maybe retry
+	roundTripTimedOut(address);
+	linkTransmitted(address, false);
 	YIELD;
     }
     // Retries exhausted
@@ -138,20 +226,58 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
     uint8_t _to;
     uint8_t _id;
     uint8_t _flags;
+#if RH_ENABLE_RELIABLE_WINDOW
+    // Send the held ACKs that can't wait any longer
+    ackWait(0);
+    if (_held.valid)
+    {
+	// Received, recorded and acknowledged by sendtoWait()
+	if (*len > _held.len)
+	    *len = _held.len;
+	memcpy(buf, _held.buf, *len);
+	_held.valid = false;
+	if (from)  *from =  _held.from;
+	if (to)    *to =    _held.to;
+	if (id)    *id =    _held.id;
+	if (flags) *flags = _held.flags;
+	return true;
+    }
+#endif
     // Get the message before its clobbered by the ACK (shared rx and tx buffer in some drivers
-    if (available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags))
+    if (RHDatagram::available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags))
     {
+	linkHeard(_from);
+#if RH_ENABLE_RELIABLE_WINDOW
+	// Take off any ACK the message carries first
+	if (   !(_flags & RH_FLAGS_ACK)
+	    && (_flags & RH_FLAGS_PIGGYBACK)
+	    && _to == _thisAddress
+	    && *len >= RH_RELIABLE_PIGGYBACK_LEN)
+	    takePiggyback(_from, buf, len, &_flags);
+#endif
 	// Never ACK an ACK
 	if (!(_flags & RH_FLAGS_ACK))
 	{
-	    // Its a normal message not an ACK
+	    // Not acknowledged, so the sender will try again. Duplicates are always acknowledged
+	    // again, this node already has them
+	    if (   _to == _thisAddress
+		&& !alreadyReceived(_from, _id, _flags)
+		&& !acceptMessage(_from, buf, *len))
+		return false;
+	    // Its a normal message not an ACK. Record it first, so the ACK includes it
+	    bool isNew = recordReceived(_from, _id, _flags);
 	    if (_to ==_thisAddress)
 	    {
-			delay(10000);
-	        // Its for this node and
-		// Its not a broadcast, so ACK it
-		// Acknowledge message with ACK set in flags and ID set to received ID
-		acknowledge(_id, _from);
+#if RH_ENABLE_RELIABLE_WINDOW
+		// The sender has more messages in this burst, the ACK for the last one covers them all
+		if (!(_flags & RH_FLAGS_MORE))
+#endif
+		{
+		    // Its for this node and
+		    // Its not a broadcast, so ACK it
+		    // Acknowledge message with ACK set in flags and ID set to received ID
+		    scheduleAck(_id, _from);
+		}
 	    }
             // Filter out retried messages that we have seen before. This explicitly
             // only filters out messages that are marked as retries to protect against
@@ -159,17 +285,23 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
             // shuts down between transmissions. Devices that do this will report the
             // the same ID each time since their internal sequence number will reset
             // to zero each time the device starts up.
-	    if ((RH_ENABLE_EXPLICIT_RETRY_DEDUP && !(_flags & RH_FLAGS_RETRY)) || _id != _seenIds[_from])
+	    if ((RH_ENABLE_EXPLICIT_RETRY_DEDUP && !(_flags & RH_FLAGS_RETRY)) || isNew)
 	    {
 		if (from)  *from =  _from;
 		if (to)    *to =    _to;
 		if (id)    *id =    _id;
 		if (flags) *flags = _flags;
-		_seenIds[_from] = _id;
 		return true;
 	    }
 	    // Else just re-ack it and wait for a new one
 	}
+#if RH_ENABLE_RELIABLE_WINDOW
+	else if (_to == _thisAddress)
+	{
+	    // An ACK for windowed messages. sendtoWait() handles its own ACKs.
+	    windowAck(_from, _id, buf, *len);
+	}
+#endif
     }
     // No message for us available
     return false;
@@ -182,7 +314,7 @@ bool RHReliableDatagram::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t
 	printf("recvtimeout");
     while ((timeLeft = timeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	if (available() || waitAvailableTimeout(ackWait(timeLeft)))
 	{
 	    if (recvfromAck(buf, len, from, to, id, flags))
 		return true;
@@ -201,18 +333,575 @@ void RHReliableDatagram::resetRetransmissions()
 {
     _retransmissions = 0;
 }
+
+#if RH_ENABLE_RELIABLE_RTT
+uint16_t RHReliableDatagram::roundTripTime(uint8_t address)
+{
+    return _roundTrip[address].srtt;
+}
+
+uint16_t RHReliableDatagram::roundTripVariation(uint8_t address)
+{
+    return _roundTrip[address].rttvar;
+}
+
+uint32_t RHReliableDatagram::retransmitTimeout(uint8_t address)
+{
+    RoundTrip* rt = &_roundTrip[address];
+    // The ACK can't arrive before the receiver has transmitted it, so the floor includes its time on air
+    uint32_t minTimeout = _timeout + _driver.timeOnAir(RH_RELIABLE_ACK_LEN);
+    uint32_t timeout = (uint32_t)rt->srtt + 4 * (uint32_t)rt->rttvar;
+    if (timeout < minTimeout)
+	timeout = minTimeout;
+    timeout <<= rt->backoff;
+    return timeout > RH_MAX_RETRANSMIT_TIMEOUT ? RH_MAX_RETRANSMIT_TIMEOUT : timeout;
+}
+
+void RHReliableDatagram::resetRoundTripTimes()
+{
+    memset(_roundTrip, 0, sizeof(_roundTrip));
+}
+#endif
+
+uint32_t RHReliableDatagram::ackTimeout(uint8_t address)
+{
+#if RH_ENABLE_RELIABLE_RTT
+    // The round trip deviation already covers the usual spread, so only a little
+    // randomness is needed to keep 2 nodes from colliding on every retransmit
+    uint32_t minTimeout = retransmitTimeout(address);
+    uint8_t spread = 2;
+#else
+    // The ACK can't arrive before the receiver has transmitted it, so add its time on air
+    // if the driver knows it. Slow modulations then don't retransmit while the ACK is on the way
+    // and fast ones don't wait longer than they have to.
+    uint32_t minTimeout = _timeout + _driver.timeOnAir(RH_RELIABLE_ACK_LEN);
+    uint8_t spread = 0;
+    (void)address;
+#endif
+
+    // Compute a new timeout, random between minTimeout and minTimeout*2 (or *1.25)
+    // This is to prevent collisions on every retransmit
+    // if 2 nodes try to transmit at the same time
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+    return minTimeout + ((minTimeout >> spread) * (random() & 0xFF) / 256);
+#else
+    return minTimeout + ((minTimeout >> spread) * random(0, 256) / 256);
+#endif
+}
+
+void RHReliableDatagram::roundTripMeasured(uint8_t address, uint32_t rtt)
+{
+#if RH_ENABLE_RELIABLE_RTT
+    RoundTrip* rt = &_roundTrip[address];
+    if (rtt > 0xffff)
+	rtt = 0xffff;
+    if (rt->srtt == 0)
+    {
+	// First measurement (RFC 6298 2.2)
+	rt->srtt = rtt ? rtt : 1;
+	rt->rttvar = rtt / 2;
+    }
+    else
+    {
+	// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R (RFC 6298 2.3)
+	int32_t error = (int32_t)rtt - rt->srtt;
+	rt->rttvar += ((error < 0 ? -error : error) - (int32_t)rt->rttvar) / 4;
+	rt->srtt += error / 8;
+	if (rt->srtt == 0)
+	    rt->srtt = 1;
+    }
+    // A measurement means ACKs are getting through again
+    rt->backoff = 0;
+#else
+    (void)address;
+    (void)rtt;
+#endif
+}
+
+void RHReliableDatagram::roundTripTimedOut(uint8_t address)
+{
+#if RH_ENABLE_RELIABLE_RTT
+    // Keep the backed off timeout until a message gets through without a retransmission (Karn)
+    if (_roundTrip[address].backoff < RH_MAX_RETRANSMIT_BACKOFF)
+	_roundTrip[address].backoff++;
+#else
+    (void)address;
+#endif
+}
+
+uint8_t RHReliableDatagram::linkCost(uint8_t address)
+{
+#if RH_ENABLE_LINK_QUALITY
+    LinkStats* link = &_links[address];
+    if (!link->sent)
+	return snrCost(link);
+    // ETX is the reciprocal of the delivery ratio
+    uint32_t cost = link->delivery ? (uint32_t)RH_ETX_UNIT * 0xffff / link->delivery : RH_LINK_COST_MAX;
+    return cost > RH_LINK_COST_MAX ? RH_LINK_COST_MAX : cost;
+#else
+    (void)address;
+    return RH_ETX_UNIT;
+#endif
+}
+
+#if RH_ENABLE_LINK_QUALITY
+int16_t RHReliableDatagram::linkRssi(uint8_t address)
+{
+    return _links[address].rssi / 16;
+}
+
+int8_t RHReliableDatagram::linkSnr(uint8_t address)
+{
+    return _links[address].snr / 16;
+}
+
+uint8_t RHReliableDatagram::linkDelivery(uint8_t address)
+{
+    return _links[address].sent ? (uint32_t)_links[address].delivery * 100 / 0xffff : 0;
+}
+
+void RHReliableDatagram::resetLinkStats()
+{
+    memset(_links, 0, sizeof(_links));
+}
+
+uint8_t RHReliableDatagram::snrCost(const LinkStats* link)
+{
+    int16_t below = RH_LINK_SNR_GOOD * 16 - link->snr;
+    if (!link->heard || below <= 0)
+	return RH_ETX_UNIT;
+    // Another expected transmission for each 4 dB below RH_LINK_SNR_GOOD
+    uint16_t cost = RH_ETX_UNIT + (uint16_t)below * RH_ETX_UNIT / 64;
+    return cost > RH_LINK_COST_MAX ? RH_LINK_COST_MAX : cost;
+}
+#endif
+
+void RHReliableDatagram::linkHeard(uint8_t address)
+{
+#if RH_ENABLE_LINK_QUALITY
+    LinkStats* link = &_links[address];
+    int16_t rssi = _driver.lastRssi() * 16;
+    int16_t snr = _driver.lastSNR() * 16;
+    if (!link->heard)
+    {
+	link->rssi = rssi;
+	link->snr = snr;
+    }
+    else
+    {
+	// Exponentially weighted moving averages, each new message weighing 1/8
+	link->rssi += (rssi - link->rssi) / 8;
+	link->snr += (snr - link->snr) / 8;
+    }
+    if (link->heard < 255)
+	link->heard++;
+#else
+    (void)address;
+#endif
+}
+
+void RHReliableDatagram::linkTransmitted(uint8_t address, bool acked)
+{
+#if RH_ENABLE_LINK_QUALITY
+    LinkStats* link = &_links[address];
+    // Start from the estimate made from the SNR, so one lost message does not make the link look dead
+    if (!link->sent)
+	link->delivery = (uint32_t)0xffff * RH_ETX_UNIT / snrCost(link);
+    link->delivery += ((acked ? 0xffff : 0) - (int32_t)link->delivery) / 8;
+    if (link->sent < 255)
+	link->sent++;
+#else
+    (void)address;
+    (void)acked;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override this to refuse messages they have no room for
+bool RHReliableDatagram::acceptMessage(uint8_t from, const uint8_t* buf, uint8_t len)
+{
+    (void)from; // Not used
+    (void)buf; // Not used
+    (void)len; // Not used
+    return true;
+}
+
+#if RH_ENABLE_RELIABLE_WINDOW
+bool RHReliableDatagram::sendtoWindow(uint8_t* buf, uint8_t len, uint8_t address, uint8_t* id)
+{
+    if (address == RH_BROADCAST_ADDRESS || windowOutstanding(address) >= _windowSize)
+	return false;
+
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+    {
+	WindowSlot* slot = &_window[i];
+	if (slot->state == WindowFree)
+	{
+	    slot->state = WindowQueued;
+	    slot->address = address;
+	    slot->id = ++_lastSequenceNumber;
+	    slot->tries = 0;
+	    slot->len = len;
+	    memcpy(slot->buf, buf, len);
+	    if (id)
+		*id = slot->id;
+	    return true;
+	}
+    }
+    // All slots in use
+    return false;
+}
+
+void RHReliableDatagram::pollWindow()
+{
+    // Messages whose ACK timed out are due again, unless they are out of retries
+    ackWait(0);
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+    {
+	WindowSlot* slot = &_window[i];
+	if (slot->state == WindowSent && millis() - slot->sentAt >= slot->timeout)
+	{
+	    linkTransmitted(slot->address, false);
+	    if (slot->tries > _retries)
+	    {
+		slot->state = WindowFree;
+		_windowFailures++;
+		windowDone(slot->address, slot->id, false);
+	    }
+	    else
+		slot->state = WindowQueued;
+	}
+    }
+
+    // Send everything due to one node as a burst, then move on to the next node
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+    {
+	if (_window[i].state != WindowQueued)
+	    continue;
+	uint8_t address = _window[i].address;
+	bool retransmitting = false;
+	for (;;)
+	{
+	    // Oldest ID first. Freed slots are reused, so slot order is not ID order
+	    WindowSlot* slot = NULL;
+	    uint8_t queued = 0;
+	    for (uint8_t j = i; j < RH_RELIABLE_WINDOW_SLOTS; j++)
+	    {
+		WindowSlot* s = &_window[j];
+		if (s->state != WindowQueued || s->address != address)
+		    continue;
+		queued++;
+		if (!slot || (int8_t)(s->id - slot->id) < 0)
+		    slot = s;
+	    }
+	    if (!slot)
+		break;
+	    // More to this node after this one?
+	    bool more = queued > 1;
+
+	    setHeaderId(slot->id);
+	    uint8_t headerFlagsToSet = (slot->tries > 0 ? RH_FLAGS_RETRY : RH_FLAGS_NONE) | (more ? RH_FLAGS_MORE : RH_FLAGS_NONE);
+	    setHeaderFlags(headerFlagsToSet, RH_FLAGS_ACK | RH_FLAGS_RETRY | RH_FLAGS_MORE);
+	    sendtoPiggyback(slot->buf, slot->len, address);
+	    waitPacketSent();
+	    if (slot->tries++ > 0)
+	    {
+		_retransmissions++;
+		retransmitting = true;
+	    }
+	    slot->state = WindowSent;
+	}
+	// The ACK for the last burst timed out. Back off once per burst, not once per message.
+	if (retransmitting)
+	    roundTripTimedOut(address);
+
+	// The receiver ACKs after the last message of the burst, so every timer starts now
+	unsigned long burstEnd = millis();
+	uint32_t timeout = ackTimeout(address);
+	for (uint8_t j = i; j < RH_RELIABLE_WINDOW_SLOTS; j++)
+	{
+	    WindowSlot* slot = &_window[j];
+	    if (slot->state == WindowSent && slot->address == address)
+	    {
+		slot->sentAt = burstEnd;
+		slot->timeout = timeout;
+	    }
+	}
+    }
+    // Leave the header flags as sendtoWait() expects them
+    setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_MORE);
+}
+
+uint8_t RHReliableDatagram::windowOutstanding(uint8_t address)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+	if (_window[i].state != WindowFree && (address == RH_BROADCAST_ADDRESS || _window[i].address == address))
+	    count++;
+    return count;
+}
+
+void RHReliableDatagram::setWindowSize(uint8_t size)
+{
+    if (size < 1)
+	size = 1;
+    if (size > RH_RELIABLE_WINDOW_SLOTS)
+	size = RH_RELIABLE_WINDOW_SLOTS;
+    _windowSize = size;
+}
+
+uint8_t RHReliableDatagram::windowSize()
+{
+    return _windowSize;
+}
+
+uint32_t RHReliableDatagram::windowFailures()
+{
+    return _windowFailures;
+}
+
+void RHReliableDatagram::windowAck(uint8_t from, uint8_t id, const uint8_t* ack, uint8_t len)
+{
+    // Older receivers only send the 1 octet ACK for the ID in the header
+    bool selective = len >= RH_RELIABLE_ACK_LEN;
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+    {
+	WindowSlot* slot = &_window[i];
+	if (slot->state == WindowFree || slot->address != from)
+	    continue;
+	bool acked = slot->id == id;
+	if (selective && !acked)
+	{
+	    // How far the message is behind the highest ID the receiver has seen
+	    uint8_t behind = ack[1] - slot->id;
+	    acked = behind == 0 || (behind <= 8 && (ack[2] & (1 << (behind - 1))));
+	}
+	if (acked)
+	{
+	    // Time only the message the ACK answers, the last of its burst, and only if it was
+	    // sent once. Messages freed through the bitmap may belong to an earlier burst.
+	    if (slot->id == id && slot->tries == 1 && slot->state == WindowSent)
+		roundTripMeasured(from, millis() - slot->sentAt);
+	    if (slot->state == WindowSent)
+		linkTransmitted(from, true);
+	    slot->state = WindowFree;
+	    windowDone(slot->address, slot->id, true);
+	}
+    }
+}
+
+bool RHReliableDatagram::takePiggyback(uint8_t from, uint8_t* buf, uint8_t* len, uint8_t* flags, uint8_t seq)
+{
+    // The acknowledgement is laid out as an ACK payload, with the ID acknowledged in place of '!'
+    windowAck(from, buf[0], buf, RH_RELIABLE_PIGGYBACK_LEN);
+    uint8_t behind = buf[1] - seq;
+    bool acked = buf[0] == seq || behind == 0 || (behind <= 8 && (buf[2] & (1 << (behind - 1))));
+
+    *len -= RH_RELIABLE_PIGGYBACK_LEN;
+    memmove(buf, buf + RH_RELIABLE_PIGGYBACK_LEN, *len);
+    *flags &= ~RH_FLAGS_PIGGYBACK;
+    return acked;
+}
+
+void RHReliableDatagram::holdMessage(uint8_t from, uint8_t to, uint8_t id, uint8_t flags, const uint8_t* buf, uint8_t len)
+{
+    if (   !alreadyReceived(from, id, flags)
+	&& (_held.valid || !acceptMessage(from, buf, len)))
+	return; // No room. The sender will retransmit it
+    // Record and acknowledge it now, as recvfromAck() would
+    bool isNew = recordReceived(from, id, flags);
+    if (!(flags & RH_FLAGS_MORE))
+	scheduleAck(id, from);
+    if (!isNew)
+	return;
+    _held.valid = true;
+    _held.from = from;
+    _held.to = to;
+    _held.id = id;
+    _held.flags = flags;
+    _held.len = len;
+    memcpy(_held.buf, buf, len);
+}
+
+void RHReliableDatagram::windowDone(uint8_t address, uint8_t id, bool delivered)
+{
+    // Default does nothing
+    (void)address;
+    (void)id;
+    (void)delivered;
+}
+#endif
+
+bool RHReliableDatagram::alreadyReceived(uint8_t from, uint8_t id, uint8_t flags)
+{
+    if (!(_rxKnown[from >> 3] & (1 << (from & 7))))
+	return false;
+    // Distance behind the highest id so far, in the 8 bit id space with wraparound
+    uint8_t behind = _rxHighest[from] - id;
+    if (behind == 0)
+	return true;
+    // A first send always has a new id, so one that was received before means the sender restarted
+    return    (flags & RH_FLAGS_RETRY)
+	   && behind <= RH_RELIABLE_DEDUP_WINDOW
+	   && (_rxBitmap[from] & ((DedupBitmap)1 << (behind - 1)));
+}
+
+bool RHReliableDatagram::recordReceived(uint8_t from, uint8_t id, uint8_t flags)
+{
+    if (alreadyReceived(from, id, flags))
+	return false;
+
+    uint8_t knownBit = 1 << (from & 7);
+    int8_t ahead = (int8_t)(id - _rxHighest[from]);
+    if (   !(_rxKnown[from >> 3] & knownBit)
+	|| ahead < -RH_RELIABLE_DEDUP_WINDOW
+	|| (   ahead < 0
+	    && !(flags & RH_FLAGS_RETRY)
+	    && (_rxBitmap[from] & ((DedupBitmap)1 << (-ahead - 1)))))
+    {
+	// First message from this node, too far behind to be a retry, or a first send with an id
+	// already received: the sender restarted. A first send that is merely late, because the
+	// sender sent its ids out of order, is recorded in the window below
+	_rxKnown[from >> 3] |= knownBit;
+	_rxHighest[from] = id;
+	_rxBitmap[from] = 0;
+    }
+    else if (ahead > 0)
+    {
+	// New highest: the old one moves into the bitmap at its new distance
+	DedupBitmap bitmap = ahead < RH_RELIABLE_DEDUP_WINDOW ? _rxBitmap[from] << ahead : 0;
+	if (ahead <= RH_RELIABLE_DEDUP_WINDOW)
+	    bitmap |= (DedupBitmap)1 << (ahead - 1);
+	_rxBitmap[from] = bitmap;
+	_rxHighest[from] = id;
+    }
+    else
+	// Late but inside the window
+	_rxBitmap[from] |= (DedupBitmap)1 << (-ahead - 1);
+    return true;
+}
  
+void RHReliableDatagram::scheduleAck(uint8_t id, uint8_t from)
+{
+#if RH_ENABLE_RELIABLE_WINDOW
+    if (_ackPolicy == AckPiggyback)
+    {
+	PendingAck* slot = NULL;
+	for (uint8_t i = 0; i < RH_RELIABLE_PENDING_ACKS; i++)
+	{
+	    PendingAck* p = &_pendingAcks[i];
+	    if (p->pending && p->from == from)
+	    {
+		// Already holding one: its selective acknowledgement will cover both
+		p->id = id;
+		return;
+	    }
+	    if (!slot || (slot->pending && (!p->pending || (long)(p->due - slot->due) < 0)))
+		slot = p;
+	}
+	// Make room by sending the ACK held longest
+	if (slot->pending)
+	    acknowledge(slot->id, slot->from);
+	slot->pending = true;
+	slot->from = from;
+	slot->id = id;
+	slot->due = millis() + _ackHoldoff;
+	return;
+    }
+#endif
+    acknowledge(id, from);
+}
+
+uint16_t RHReliableDatagram::ackWait(uint16_t timeLeft)
+{
+#if RH_ENABLE_RELIABLE_WINDOW
+    for (uint8_t i = 0; i < RH_RELIABLE_PENDING_ACKS; i++)
+    {
+	PendingAck* p = &_pendingAcks[i];
+	if (!p->pending)
+	    continue;
+	long untilDue = (long)(p->due - millis());
+	if (untilDue <= 0)
+	{
+	    // Nothing came along to carry it
+	    p->pending = false;
+	    acknowledge(p->id, p->from);
+	}
+	else if (untilDue < timeLeft)
+	    timeLeft = untilDue;
+    }
+#endif
+    return timeLeft;
+}
+
+uint16_t RHReliableDatagram::windowWait(uint16_t timeLeft)
+{
+#if RH_ENABLE_RELIABLE_WINDOW
+    pollWindow();
+    for (uint8_t i = 0; i < RH_RELIABLE_WINDOW_SLOTS; i++)
+    {
+	WindowSlot* slot = &_window[i];
+	if (slot->state != WindowSent)
+	    continue;
+	long untilDue = (long)(slot->sentAt + slot->timeout - millis());
+	if (untilDue <= 0)
+	    timeLeft = 0;
+	else if (untilDue < timeLeft)
+	    timeLeft = untilDue;
+    }
+#endif
+    return timeLeft;
+}
+
+bool RHReliableDatagram::sendtoPiggyback(uint8_t* buf, uint8_t len, uint8_t address)
+{
+#if RH_ENABLE_RELIABLE_WINDOW
+    for (uint8_t i = 0; i < RH_RELIABLE_PENDING_ACKS; i++)
+    {
+	PendingAck* p = &_pendingAcks[i];
+	// If there is no room for it, the ACK is sent on its own when it is due
+	if (   p->pending
+	    && p->from == address
+	    && (uint16_t)len + RH_RELIABLE_PIGGYBACK_LEN <= _driver.maxMessageLength())
+	{
+	    uint8_t message[RH_MAX_MESSAGE_LEN];
+	    message[0] = p->id;
+	    message[1] = _rxHighest[address];
+	    message[2] = (uint8_t)_rxBitmap[address];
+	    memcpy(message + RH_RELIABLE_PIGGYBACK_LEN, buf, len);
+	    p->pending = false;
+	    setHeaderFlags(RH_FLAGS_PIGGYBACK, RH_FLAGS_NONE);
+	    bool ret = sendto(message, len + RH_RELIABLE_PIGGYBACK_LEN, address);
+	    setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_PIGGYBACK);
+	    return ret;
+	}
+    }
+#endif
+    return sendto(buf, len, address);
+}
+
 void RHReliableDatagram::acknowledge(uint8_t id, uint8_t from)
 {
+    setHeaderTo(from);
     setHeaderId(id);
-    setHeaderFlags(RH_FLAGS_ACK);
+    setHeaderFlags(RH_FLAGS_ACK, RH_FLAGS_APPLICATION_SPECIFIC | RH_FLAGS_MORE | RH_FLAGS_PIGGYBACK);
     // We would prefer to send a zero length ACK,
     // but if an RH_RF22 receives a 0 length message with a CRC error, it will never receive
     // a 0 length message again, until its reset, which makes everything hang :-(
     // So we send an ACK of 1 octet
     // REVISIT: should we send the RSSI for the information of the sender?
-    uint8_t ack = '!';
-    sendto(&ack, sizeof(ack), from); 
+#if RH_ENABLE_RELIABLE_WINDOW
+    // Also say which of the recent messages from this node arrived, so a windowed sender
+    // only retransmits the missing ones. Older senders only look at the header ID.
+    uint8_t ack[RH_RELIABLE_ACK_LEN] = {'!', _rxHighest[from], (uint8_t)_rxBitmap[from]};
+#else
+    uint8_t ack[RH_RELIABLE_ACK_LEN] = {'!'};
+#endif
+    // Everything is ready, so the holdoff is the only wait before the transmitter starts
+    uint32_t holdoff = ackHoldoff();
+    if (holdoff)
+	delay(holdoff);
+    _driver.sendReply(ack, RH_RELIABLE_ACK_LEN);
     waitPacketSent();
 }
 
@@ -15,6 +15,13 @@
 /// The retry bit in the header FLAGS. This indicates that the payload is a retry for a
 /// previously sent message.
 #define RH_FLAGS_RETRY 0x40
+/// The more bit in the header FLAGS. This indicates that more windowed messages to the same
+/// node follow in this burst, so the receiver holds its ACK until the last one.
+#define RH_FLAGS_MORE 0x20
+/// The piggyback bit in the header FLAGS. This indicates that the payload starts with an acknowledgement
+/// for the receiver, RH_RELIABLE_PIGGYBACK_LEN octets: the ID acknowledged, then the selective
+/// acknowledgement. The message itself follows.
+#define RH_FLAGS_PIGGYBACK 0x10
 
 /// This macro enables enhanced message deduplication behavior. This currently defaults
 /// to 0 (off), but this may change to default to 1 (on) in future releases. Consumers who
@@ -29,12 +36,110 @@
 /// do not support the RETRY header. If you do, deduping of messages will be broken.
 #define RH_ENABLE_EXPLICIT_RETRY_DEDUP 0
 
+/// Number of recent sequence numbers remembered from each node for duplicate detection: 8, 16 or 32.
+/// A message is a duplicate if its sequence number is the highest yet received from its sender, or if
+/// it is a retry of one of the RH_RELIABLE_DEDUP_WINDOW before that which was received, so messages that arrive
+/// out of order are still delivered once each. Costs RH_RELIABLE_DEDUP_WINDOW / 8 + 1 octets per possible node address.
+#ifndef RH_RELIABLE_DEDUP_WINDOW
+ #if defined(__AVR__)
+  #define RH_RELIABLE_DEDUP_WINDOW 8
+ #else
+  #define RH_RELIABLE_DEDUP_WINDOW 32
+ #endif
+#endif
+
+/// This macro enables the windowed transport: sendtoWindow(), pollWindow() and the
+/// selective acknowledgement carried in every ACK. It needs RH_RELIABLE_WINDOW_SLOTS message
+/// buffers of RH_MAX_MESSAGE_LEN octets plus about 550 octets per instance, so it
+/// defaults to off on AVR. Override it in your code to change that.
+#ifndef RH_ENABLE_RELIABLE_WINDOW
+ #if defined(__AVR__)
+  #define RH_ENABLE_RELIABLE_WINDOW 0
+ #else
+  #define RH_ENABLE_RELIABLE_WINDOW 1
+ #endif
+#endif
+
+/// Number of messages the windowed transport can hold, across all destinations
+#ifndef RH_RELIABLE_WINDOW_SLOTS
+ #define RH_RELIABLE_WINDOW_SLOTS 8
+#endif
+
+/// The default number of unacknowledged windowed messages per destination
+#define RH_DEFAULT_WINDOW_SIZE 4
+
+/// This macro enables the adaptive retransmit timeout: the round trip time to each node is
+/// measured and the retransmit timeout follows it, backing off exponentially while ACKs are lost.
+/// It needs 5 octets per possible node address, about 1.3 kB per instance, so it defaults to off
+/// on AVR, where every retransmit waits setTimeout() as before. Override it in your code to change that.
+#ifndef RH_ENABLE_RELIABLE_RTT
+ #if defined(__AVR__)
+  #define RH_ENABLE_RELIABLE_RTT 0
+ #else
+  #define RH_ENABLE_RELIABLE_RTT 1
+ #endif
+#endif
+
+/// The longest the adaptive retransmit timeout can grow to, in milliseconds
+#define RH_MAX_RETRANSMIT_TIMEOUT 60000
+
+/// The most times the adaptive retransmit timeout is doubled for lost ACKs
+#define RH_MAX_RETRANSMIT_BACKOFF 6
+
+/// This macro enables link quality statistics for each neighbour: the average RSSI and SNR
+/// of what is heard from it and the fraction of transmissions to it that are acknowledged,
+/// from which linkCost() estimates the expected transmission count (ETX). It needs 8 octets
+/// per possible node address, 2 kB per instance, so it defaults to off on AVR, where every
+/// link costs RH_ETX_UNIT. Override it in your code to change that.
+#ifndef RH_ENABLE_LINK_QUALITY
+ #if defined(__AVR__)
+  #define RH_ENABLE_LINK_QUALITY 0
+ #else
+  #define RH_ENABLE_LINK_QUALITY 1
+ #endif
+#endif
+
+/// linkCost() counts expected transmissions in units of 1/RH_ETX_UNIT. A link that
+/// delivers every message first time costs RH_ETX_UNIT.
+#define RH_ETX_UNIT 4
+
+/// The most linkCost() returns, for links that deliver nothing: 16 expected transmissions
+#define RH_LINK_COST_MAX (16 * RH_ETX_UNIT)
+
+/// Until a transmission to a neighbour has been acknowledged or lost, its link cost is estimated
+/// from the SNR of what was heard from it: a link at or above this SNR (dB) costs RH_ETX_UNIT,
+/// and each 4 dB below it adds another expected transmission.
+/// Radios that do not report SNR give 0, so their links cost RH_ETX_UNIT until measured.
+#ifndef RH_LINK_SNR_GOOD
+ #define RH_LINK_SNR_GOOD 0
+#endif
+
 /// the default retry timeout in milliseconds
 #define RH_DEFAULT_TIMEOUT 200
 
 /// The default number of retries
 #define RH_DEFAULT_RETRIES 10
 
+/// With AckAirtime, the acknowledgement holdoff is the ACK's time on air shifted right by this.
+/// An ACK is about 20 LoRa symbols, so this holds off about 2 symbols at any spreading factor.
+#define RH_ACK_AIRTIME_HOLDOFF_SHIFT 3
+
+/// Length of the ACK message payload. See acknowledge()
+#if RH_ENABLE_RELIABLE_WINDOW
+ #define RH_RELIABLE_ACK_LEN 3
+#else
+ #define RH_RELIABLE_ACK_LEN 1
+#endif
+
+/// Length of the acknowledgement carried at the start of a message with RH_FLAGS_PIGGYBACK
+#define RH_RELIABLE_PIGGYBACK_LEN 3
+
+/// Number of nodes AckPiggyback can hold an ACK for at once. Another node's message
+/// sends the ACK held longest at once.
+#ifndef RH_RELIABLE_PENDING_ACKS
+ #define RH_RELIABLE_PENDING_ACKS 4
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHReliableDatagram RHReliableDatagram.h <RHReliableDatagram.h>
 /// \brief RHDatagram subclass for sending addressed, acknowledged, retransmitted datagrams.
@@ -98,6 +203,45 @@ public:
     /// \param[in] thisAddress The address to assign to this node. Defaults to 0
     RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddress = 0);
 
+    /// When to send the acknowledgement for a received message. See setAckPolicy()
+    typedef enum
+    {
+	AckImmediate = 0,      ///< Acknowledge as soon as the message has been read (the default)
+	AckHoldoff,            ///< Wait a fixed holdoff before acknowledging
+	AckAirtime,            ///< Wait a holdoff that follows the modulation, see RH_ACK_AIRTIME_HOLDOFF_SHIFT
+	AckPiggyback           ///< Hold the ACK up to the holdoff, to carry it on a message to the same node
+    } AckPolicy;
+
+    /// Sets when recvfromAck() and sendtoWait() acknowledge a received message.
+    /// The ACK frame is always built before the holdoff, and sent with RHGenericDriver::sendReply(),
+    /// which on radios such as RH_RF95 skips CAD, so after the holdoff only loading the
+    /// transmitter stands between the received message and the ACK.
+    /// A holdoff gives a sender that is slow to turn its radio round to receive time to start
+    /// listening before the ACK's preamble. AckImmediate suits most radios.
+    ///
+    /// With AckPiggyback (and RH_ENABLE_RELIABLE_WINDOW) the ACK is not sent at once. If this node sends
+    /// a message to the same node within the holdoff, with sendtoWait() or pollWindow() (and so RHRouter
+    /// and RHMesh), the ACK rides at the start of that message with RH_FLAGS_PIGGYBACK, saving a whole frame.
+    /// Otherwise it is sent on its own when the holdoff expires, by the next recvfromAck(), recvfromAckTimeout(),
+    /// pollWindow() or sendtoWait(), so call one of those frequently. Nodes sending here should have a
+    /// timeout longer than the holdoff, which the adaptive timeout of RH_ENABLE_RELIABLE_RTT soon learns.
+    /// The receiver must run a version of this library that understands RH_FLAGS_PIGGYBACK.
+    /// \param[in] policy The new policy
+    /// \param[in] holdoff The holdoff in milliseconds for AckHoldoff and AckPiggyback. Ignored by the other policies.
+    void setAckPolicy(AckPolicy policy, uint16_t holdoff = 0);
+
+    /// Returns the current acknowledgement policy, set by setAckPolicy()
+    AckPolicy ackPolicy();
+
+    /// Returns how long the current policy waits before each acknowledgement
+    /// \return The holdoff in milliseconds. 0 for AckPiggyback, which holds ACKs without waiting.
+    uint32_t ackHoldoff();
+
+    /// Tests whether a new message is available, including a message for this node that sendtoWait()
+    /// received and acknowledged while waiting for its ACK. recvfromAck() returns that first.
+    /// \return true if a new message is available to be retrieved by recvfromAck()
+    bool available();
+
     /// Sets the minimum retransmit timeout. If sendtoWait is waiting for an ack 
     /// longer than this time (in milliseconds), 
     /// it will retransmit the message. Defaults to 200ms. The timeout is measured from the end of
@@ -106,7 +250,11 @@ public:
     /// For fast modulation schemes you can considerably shorten this time.
     /// Caution: if you are using slow packet rates and long packets 
     /// you may need to change the timeout for reliable operations.
+    /// If the driver reports timeOnAir(), the transmit time of the acknowledgement is added
+    /// to the timeout automatically, so it only needs to cover the latency of the receiver.
     /// The actual timeout is randomly varied between timeout and timeout*2.
+    /// With RH_ENABLE_RELIABLE_RTT, this is only the timeout used before the first round trip
+    /// to a node has been measured, and the least the adaptive timeout will go down to. See retransmitTimeout().
     /// \param[in] timeout The new timeout period in milliseconds
     void setTimeout(uint16_t timeout);
 
@@ -123,7 +271,10 @@ public:
     uint8_t retries();
 
     /// Send the message (with retries) and waits for an ack. Returns true if an acknowledgement is received.
-    /// Synchronous: any message other than the desired ACK received while waiting is discarded.
+    /// Synchronous: any message other than the desired ACK received while waiting is discarded, except that
+    /// with RH_ENABLE_RELIABLE_WINDOW one new message for this node is acknowledged and kept for recvfromAck().
+    /// Two nodes sending to each other at the same time then acknowledge each other instead of
+    /// both waiting until their retries are exhausted.
     /// Blocks until an ACK is received or all retries are exhausted (ie up to retries*timeout milliseconds).
     /// If the destination address is the broadcast address RH_BROADCAST_ADDRESS (255), the message will 
     /// be sent as a broadcast, but receiving nodes do not acknowledge, and sendtoWait() returns true immediately
@@ -181,16 +332,226 @@ public:
     /// to 0. 
     void resetRetransmissions(); 
 
+#if RH_ENABLE_RELIABLE_RTT
+    /// Returns the smoothed round trip time to address: the time from the end of a transmission
+    /// to the end of its ACK, averaged over recent messages. Following Karn's algorithm, only
+    /// messages that were acknowledged without being retransmitted are measured.
+    /// \param[in] address The node to look up
+    /// \return The smoothed round trip time in milliseconds, or 0 if none has been measured yet
+    uint16_t roundTripTime(uint8_t address);
+
+    /// Returns the smoothed mean deviation of the round trip time to address
+    /// \param[in] address The node to look up
+    /// \return The round trip time variation in milliseconds, or 0 if none has been measured yet
+    uint16_t roundTripVariation(uint8_t address);
+
+    /// Returns the current retransmit timeout for address, before the random variation.
+    /// This is roundTripTime() plus 4 times roundTripVariation() (RFC 6298), but no less than
+    /// setTimeout() plus the time on air of the ACK, which is also the timeout until the first
+    /// measurement. It is doubled each time an ACK from address times out, up to
+    /// RH_MAX_RETRANSMIT_BACKOFF times, and returns to normal with the next measurement.
+    /// The actual timeout is randomly varied between this and this*1.25.
+    /// \param[in] address The node to look up
+    /// \return The retransmit timeout in milliseconds, at most RH_MAX_RETRANSMIT_TIMEOUT
+    uint32_t retransmitTimeout(uint8_t address);
+
+    /// Forgets the round trip times measured to every node, for example after changing the
+    /// modem configuration.
+    void resetRoundTripTimes();
+#endif
+
+    /// Returns the estimated cost of sending a message to the neighbour address: the expected number
+    /// of transmissions (ETX) until it is acknowledged, in units of 1/RH_ETX_UNIT.
+    /// Once messages have been sent to address, this is 1 / linkDelivery(). Before that it is
+    /// estimated from linkSnr(), see RH_LINK_SNR_GOOD.
+    /// Without RH_ENABLE_LINK_QUALITY every link costs RH_ETX_UNIT.
+    /// \param[in] address The neighbour to look up
+    /// \return The link cost, RH_ETX_UNIT to RH_LINK_COST_MAX
+    uint8_t linkCost(uint8_t address);
+
+#if RH_ENABLE_LINK_QUALITY
+    /// Returns the average RSSI of the messages received from address, including ACKs and
+    /// broadcasts. Each new message has a weight of 1/8 in the average.
+    /// \param[in] address The neighbour to look up
+    /// \return The average RSSI in dBm, or 0 if nothing has been heard from address
+    int16_t linkRssi(uint8_t address);
+
+    /// Returns the average SNR of the messages received from address, if the radio reports it
+    /// \param[in] address The neighbour to look up
+    /// \return The average SNR in dB, or 0 if nothing has been heard from address
+    int8_t linkSnr(uint8_t address);
+
+    /// Returns the fraction of recent transmissions to address that were acknowledged,
+    /// each new outcome having a weight of 1/8
+    /// \param[in] address The neighbour to look up
+    /// \return The delivery ratio in percent, or 0 if nothing has been sent to address
+    uint8_t linkDelivery(uint8_t address);
+
+    /// Forgets the link statistics for every node, for example after changing the
+    /// modem configuration.
+    void resetLinkStats();
+#endif
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Queues a message for windowed delivery to address and returns at once.
+    /// Unlike sendtoWait(), several messages to the same node may be unacknowledged at a time.
+    /// Nothing is transmitted until the next pollWindow().
+    /// \param[in] buf Pointer to the binary message to send
+    /// \param[in] len Number of octets to send
+    /// \param[in] address The address to send the message to. Broadcasts are never acknowledged, so
+    /// RH_BROADCAST_ADDRESS is refused: use sendto() for those.
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the ID the message
+    /// will be sent with, which windowDone() reports.
+    /// \return true if the message was queued. false if address already has windowSize() messages
+    /// outstanding, all RH_RELIABLE_WINDOW_SLOTS are in use, or address is the broadcast address.
+    bool sendtoWindow(uint8_t* buf, uint8_t len, uint8_t address, uint8_t* id = NULL);
+
+    /// Transmits queued windowed messages and retransmits those whose ACK timed out.
+    /// Messages due to the same node are sent back to back in ID order, all but the last with RH_FLAGS_MORE,
+    /// so the receiver acknowledges the whole burst with one ACK. Its selective acknowledgement
+    /// names every message of the burst that arrived, and only the missing ones are sent again.
+    /// Messages still unacknowledged after retries() retransmissions are dropped and counted
+    /// in windowFailures(). ACKs are processed by recvfromAck(), so call both frequently.
+    void pollWindow();
+
+    /// Returns the number of windowed messages to address that are queued or not yet acknowledged.
+    /// \param[in] address The destination to count, or RH_BROADCAST_ADDRESS for all destinations
+    /// \return The number of outstanding messages
+    uint8_t windowOutstanding(uint8_t address = RH_BROADCAST_ADDRESS);
+
+    /// Sets the most windowed messages that may be outstanding to one destination.
+    /// Defaults to RH_DEFAULT_WINDOW_SIZE. 1 gives stop-and-wait without blocking.
+    /// \param[in] size The new window size, clamped to 1..RH_RELIABLE_WINDOW_SLOTS
+    void setWindowSize(uint8_t size);
+
+    /// Returns the current window size, set by setWindowSize()
+    uint8_t windowSize();
+
+    /// Returns the number of windowed messages dropped after exhausting their retries
+    /// since starting.
+    uint32_t windowFailures();
+#endif
+
 protected:
-    /// Send an ACK for the message id to the given from address
+    /// Send an ACK for the message id to the given from address, after the holdoff set by setAckPolicy()
     /// Blocks until the ACK has been sent
     void acknowledge(uint8_t id, uint8_t from);
 
+    /// Acknowledges the message id from from as the AckPolicy says: at once with acknowledge(),
+    /// or for AckPiggyback by holding the ACK for the next message to from
+    void scheduleAck(uint8_t id, uint8_t from);
+
+    /// Sends the held ACKs whose holdoff has expired, and returns how long a caller about to wait
+    /// for a message may wait before it has to call this again
+    /// \param[in] timeLeft How long the caller wants to wait, in milliseconds
+    /// \return The lesser of timeLeft and the time until the next held ACK is due
+    uint16_t ackWait(uint16_t timeLeft);
+
+    /// Calls pollWindow() if RH_ENABLE_RELIABLE_WINDOW, and returns how long a caller about to wait
+    /// for a message may wait before it has to call this again
+    /// \param[in] timeLeft How long the caller wants to wait, in milliseconds
+    /// \return The lesser of timeLeft and the time until the next windowed message's ACK times out
+    uint16_t windowWait(uint16_t timeLeft);
+
+    /// Like sendto(), but carries the ACK held for address, if any, at the start of the message
+    /// \return true if the message was queued for transmit
+    bool sendtoPiggyback(uint8_t* buf, uint8_t len, uint8_t address);
+
     /// Checks whether the message currently in the Rx buffer is a new message, not previously received
     /// based on the from address and the sequence.  If it is new, it is acknowledged and returns true
     /// \return true if there is a message received and it is a new message
     bool haveNewMessage();
 
+    /// Checks whether message id from from was already received, without recording it.
+    /// Only a message with RH_FLAGS_RETRY in flags can repeat an id older than the highest one,
+    /// since the first send of a message always takes a new id.
+    /// \return true if id is in the duplicate detection window of from and was received
+    bool alreadyReceived(uint8_t from, uint8_t id, uint8_t flags);
+
+    /// Records that message id from from arrived, for duplicate detection and the selective
+    /// acknowledgement. A first send with an id already received, or any message more than
+    /// RH_RELIABLE_DEDUP_WINDOW behind the highest id so far, is taken to mean the sender restarted
+    /// its sequence numbers or used them for other nodes, and starts a new window. Other late
+    /// first sends are recorded in the window as they are, since the sender may send its ids out of order.
+    /// \return true if the message is new, false if it is a duplicate
+    bool recordReceived(uint8_t from, uint8_t id, uint8_t flags);
+
+    /// Returns how long to wait for an ACK from address after a transmission ends.
+    /// With RH_ENABLE_RELIABLE_RTT this is retransmitTimeout() randomly varied up to 1.25 times that,
+    /// else the timeout plus the ACK's time on air, randomly varied up to twice that.
+    uint32_t ackTimeout(uint8_t address);
+
+    /// Called with the time between the end of a transmission to address and the arrival of its ACK.
+    /// Only call it for messages that were not retransmitted.
+    void roundTripMeasured(uint8_t address, uint32_t rtt);
+
+    /// Called when an ACK from address timed out, to back off the retransmit timeout
+    void roundTripTimedOut(uint8_t address);
+
+    /// Called with each message received from address, to average the RSSI and SNR the driver
+    /// reports for it
+    void linkHeard(uint8_t address);
+
+    /// Called when the ACK for a transmission to address arrives or times out
+    /// \param[in] acked true if it was acknowledged
+    void linkTransmitted(uint8_t address, bool acked);
+
+    /// Called with each new message addressed to this node before it is recorded and acknowledged.
+    /// A message that is refused is ignored as if it was never heard, so its sender retransmits it.
+    /// Duplicates of messages already received are not offered, they are acknowledged again.
+    /// Subclasses may override this to push back while they have no room for the message.
+    /// The default accepts every message.
+    /// \param[in] from The node the message came from
+    /// \param[in] buf The message
+    /// \param[in] len Number of octets in buf
+    /// \return true to accept the message
+    virtual bool acceptMessage(uint8_t from, const uint8_t* buf, uint8_t len);
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Frees the windowed messages to from that an ACK with id and payload ack acknowledges
+    void windowAck(uint8_t from, uint8_t id, const uint8_t* ack, uint8_t len);
+
+    /// Processes the acknowledgement at the start of message buf from from, which has RH_FLAGS_PIGGYBACK,
+    /// and removes it, leaving the message itself in buf
+    /// \param[in] seq A sequence number to check
+    /// \return true if the acknowledgement includes seq
+    bool takePiggyback(uint8_t from, uint8_t* buf, uint8_t* len, uint8_t* flags, uint8_t seq = 0);
+
+    /// Called when a windowed message leaves the window, either acknowledged or out of retries.
+    /// Subclasses may override this to learn what became of the messages they queued.
+    /// The default does nothing.
+    /// \param[in] address The destination the message was sent to
+    /// \param[in] id The ID sendtoWindow() gave the message
+    /// \param[in] delivered true if the message was acknowledged, false if it was dropped
+    virtual void windowDone(uint8_t address, uint8_t id, bool delivered);
+
+    /// Records and acknowledges a new message for this node that sendtoWait() received, and keeps
+    /// it for recvfromAck(). Only one message is kept: while one is, others are ignored and their
+    /// senders retransmit them.
+    void holdMessage(uint8_t from, uint8_t to, uint8_t id, uint8_t flags, const uint8_t* buf, uint8_t len);
+
+    /// States of a windowed message slot
+    typedef enum
+    {
+	WindowFree = 0,        ///< Slot is unused
+	WindowQueued,          ///< Message is waiting to be (re)transmitted by pollWindow()
+	WindowSent             ///< Message was transmitted and is waiting for its ACK
+    } WindowState;
+
+    /// A windowed message and its retransmit timer
+    typedef struct
+    {
+	uint8_t       state;       ///< One of WindowState
+	uint8_t       address;     ///< Destination
+	uint8_t       id;          ///< Header ID, the sequence number
+	uint8_t       tries;       ///< Transmissions so far
+	unsigned long sentAt;      ///< millis() at the end of the last transmission
+	uint32_t      timeout;     ///< ms after sentAt to retransmit
+	uint8_t       len;         ///< Number of octets in buf
+	uint8_t       buf[RH_MAX_MESSAGE_LEN]; ///< The message
+    } WindowSlot;
+#endif
+
 private:
     /// Count of retransmissions we have had to send
     uint32_t _retransmissions;
@@ -207,11 +568,103 @@ private:
     /// Defaults to 3
     uint8_t _retries;
 
-    /// Array of the last seen sequence number indexed by node address that sent it
-    /// It is used for duplicate detection. Duplicated messages are re-acknowledged when received 
+    /// When to acknowledge, one of AckPolicy
+    /// Defaults to AckImmediate
+    uint8_t _ackPolicy;
+
+    /// Holdoff for AckHoldoff (milliseconds)
+    uint16_t _ackHoldoff;
+
+#if RH_RELIABLE_DEDUP_WINDOW > 16
+    typedef uint32_t DedupBitmap;
+#elif RH_RELIABLE_DEDUP_WINDOW > 8
+    typedef uint16_t DedupBitmap;
+#else
+    typedef uint8_t DedupBitmap;
+#endif
+
+    /// Highest sequence number received from each node, indexed by node address.
+    /// With _rxBitmap it is used for duplicate detection. Duplicated messages are re-acknowledged when received 
     /// (this is generally due to lost ACKs, causing the sender to retransmit, even though we have already
-    /// received that message)
-    uint8_t _seenIds[256];
+    /// received that message). It is also sent back in every ACK.
+    uint8_t _rxHighest[256];
+
+    /// For each node, bit n set if message _rxHighest - 1 - n was received.
+    /// The low 8 bits are the selective acknowledgement.
+    DedupBitmap _rxBitmap[256];
+
+    /// Bit per node, set once anything was received from it
+    uint8_t _rxKnown[32];
+
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Windowed messages, queued or waiting for their ACK
+    WindowSlot _window[RH_RELIABLE_WINDOW_SLOTS];
+
+    /// Most windowed messages outstanding to one destination
+    uint8_t _windowSize;
+
+    /// Count of windowed messages dropped after exhausting their retries
+    uint32_t _windowFailures;
+
+    /// An ACK held by AckPiggyback
+    typedef struct
+    {
+	bool          pending;     ///< The ACK has not been sent
+	uint8_t       from;        ///< The node to acknowledge
+	uint8_t       id;          ///< The latest ID to acknowledge
+	unsigned long due;         ///< millis() by which to send it on its own
+    } PendingAck;
+
+    /// ACKs held by AckPiggyback
+    PendingAck _pendingAcks[RH_RELIABLE_PENDING_ACKS];
+
+    /// A message for this node that sendtoWait() received while waiting for its ACK,
+    /// already acknowledged, kept for recvfromAck()
+    typedef struct
+    {
+	bool          valid;       ///< A message is held
+	uint8_t       from;        ///< Header FROM
+	uint8_t       to;          ///< Header TO
+	uint8_t       id;          ///< Header ID
+	uint8_t       flags;       ///< Header FLAGS, without RH_FLAGS_PIGGYBACK
+	uint8_t       len;         ///< Number of octets in buf
+	uint8_t       buf[RH_MAX_MESSAGE_LEN]; ///< The message, without the acknowledgement
+    } HeldMessage;
+
+    /// The message kept by sendtoWait()
+    HeldMessage _held;
+#endif
+
+#if RH_ENABLE_RELIABLE_RTT
+    /// Round trip estimates for one node, all in milliseconds
+    typedef struct
+    {
+	uint16_t      srtt;        ///< Smoothed round trip time, 0 until the first measurement
+	uint16_t      rttvar;      ///< Smoothed mean deviation of the round trip time
+	uint8_t       backoff;     ///< Number of times the timeout has been doubled since the last measurement
+    } RoundTrip;
+
+    /// Round trip estimates indexed by node address
+    RoundTrip _roundTrip[256];
+#endif
+
+#if RH_ENABLE_LINK_QUALITY
+    /// Link statistics for one neighbour
+    typedef struct
+    {
+	int16_t       rssi;        ///< Average RSSI in 1/16 dBm
+	int16_t       snr;         ///< Average SNR in 1/16 dB
+	uint16_t      delivery;    ///< Average fraction of transmissions acknowledged, 0xffff is all
+	uint8_t       heard;       ///< Messages received, stopping at 255
+	uint8_t       sent;        ///< Transmissions acknowledged or lost, stopping at 255
+    } LinkStats;
+
+    /// Link cost estimated from the SNR heard, for links nothing has been sent over yet
+    uint8_t snrCost(const LinkStats* link);
+
+    /// Link statistics indexed by node address
+    LinkStats _links[256];
+#endif
 };
 
 /// @example rf22_reliable_datagram_client.pde
@@ -13,8 +13,6 @@
 
 #include <RHRouter.h>
 
-RHRouter::RoutedMessage RHRouter::_tmpMessage;
-
 ////////////////////////////////////////////////////////////////////
 // Constructors
 RHRouter::RHRouter(RHGenericDriver& driver, uint8_t thisAddress) 
@@ -22,7 +20,20 @@ RHRouter::RHRouter(RHGenericDriver& driver, uint8_t thisAddress)
 {
     _max_hops = RH_DEFAULT_MAX_HOPS;
     _isa_router = true;
+    _routeLifetime = 0;
     clearRoutingTable();
+#if RH_ENABLE_ROUTER_FLOOD
+    // No flood comes from the broadcast address, so these match nothing
+    memset(_floodSeen, RH_BROADCAST_ADDRESS, sizeof(_floodSeen));
+    _floodSeenNext = 0;
+    memset(_floodSlots, 0, sizeof(_floodSlots));
+    _floodCopies = RH_DEFAULT_FLOOD_COPIES;
+#endif
+#if RH_ENABLE_ROUTER_QUEUE
+    memset(_forward, 0, sizeof(_forward));
+    _forwardOrder = 0;
+    _forwardDrops = 0;
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -47,81 +58,116 @@ void RHRouter::setIsaRouter(bool isa_router)
     _isa_router = isa_router;
 }
 ////////////////////////////////////////////////////////////////////
-void RHRouter::addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state)
+void RHRouter::addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state, uint8_t cost)
 {
-    uint8_t i;
+#if RH_ROUTING_TABLE_SIZE == 256
+    // Every address has its own entry
+    RoutingTableEntry* route = &_routes[dest];
+#else
+    RoutingTableEntry* route = NULL;
+    uint16_t i;
 
-    // First look for an existing entry we can update
+    // Look for an existing entry we can update, else an invalid entry we can use
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
     {
-	if (_routes[i].dest == dest)
+	if (_routes[i].dest == dest && _routes[i].state != Invalid)
 	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
+	    route = &_routes[i];
+	    break;
 	}
+	if (!route && _routes[i].state == Invalid)
+	    route = &_routes[i];
     }
 
-    // Look for an invalid entry we can use
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    if (!route)
     {
-	if (_routes[i].state == Invalid)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
-	}
+	// Need to make room for a new one
+	route = &_routes[oldestRoute()];
+	route->state = Invalid;
     }
+#endif
+    uint32_t now = millis();
+    if (route->state == Invalid)
+	route->lastUsed = now; // A new route is as fresh as if it had just been used
+    route->dest = dest;
+    route->next_hop = next_hop;
+    route->state = state;
+    route->cost = cost;
+    route->lastHeard = now;
+}
 
-    // Need to make room for a new one
-    retireOldestRoute();
-    // Should be an invalid slot now
+////////////////////////////////////////////////////////////////////
+RHRouter::RoutingTableEntry* RHRouter::getRouteTo(uint8_t dest)
+{
+    RoutingTableEntry* route = NULL;
+#if RH_ROUTING_TABLE_SIZE == 256
+    if (_routes[dest].state != Invalid)
+	route = &_routes[dest];
+#else
+    uint16_t i;
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].state == Invalid)
+	if (_routes[i].dest == dest && _routes[i].state != Invalid)
 	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
+	    route = &_routes[i];
+	    break;
 	}
+#endif
+    if (route && _routeLifetime && (uint32_t)(millis() - route->lastHeard) >= _routeLifetime)
+    {
+	// Expired
+	route->state = Invalid;
+	route = NULL;
     }
+    if (route)
+	route->lastUsed = millis();
+    return route;
 }
 
 ////////////////////////////////////////////////////////////////////
-RHRouter::RoutingTableEntry* RHRouter::getRouteTo(uint8_t dest)
+void RHRouter::setRouteLifetime(uint32_t lifetime)
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-	if (_routes[i].dest == dest && _routes[i].state != Invalid)
-	    return &_routes[i];
-    return NULL;
+    _routeLifetime = lifetime;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHRouter::routeLifetime()
+{
+    return _routeLifetime;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::deleteRoute(uint8_t index)
 {
-    // Delete a route by copying following routes on top of it
-    memcpy(&_routes[index], &_routes[index+1], 
-	   sizeof(RoutingTableEntry) * (RH_ROUTING_TABLE_SIZE - index - 1));
-    _routes[RH_ROUTING_TABLE_SIZE - 1].state = Invalid;
+    _routes[index].state = Invalid;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::printRoutingTable()
 {
 #ifdef RH_HAVE_SERIAL
-    uint8_t i;
+    uint16_t i;
+    uint32_t now = millis();
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
     {
-	Serial.print(i, DEC);
+#if RH_ROUTING_TABLE_SIZE == 256
+	// Only the addresses we have routes for
+	if (_routes[i].state == Invalid)
+	    continue;
+#endif
+	Serial.print((unsigned int)i, DEC);
 	Serial.print(" Dest: ");
 	Serial.print(_routes[i].dest, DEC);
 	Serial.print(" Next Hop: ");
 	Serial.print(_routes[i].next_hop, DEC);
 	Serial.print(" State: ");
-	Serial.println(_routes[i].state, DEC);
+	Serial.print(_routes[i].state, DEC);
+	Serial.print(" Cost: ");
+	Serial.print(_routes[i].cost, DEC);
+	Serial.print(" Heard: ");
+	Serial.print(now - _routes[i].lastHeard, DEC);
+	Serial.print(" Used: ");
+	Serial.print(now - _routes[i].lastUsed, DEC);
+	Serial.println("");
     }
 #endif
 }
@@ -129,31 +175,63 @@ void RHRouter::printRoutingTable()
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::deleteRouteTo(uint8_t dest)
 {
-    uint8_t i;
+#if RH_ROUTING_TABLE_SIZE == 256
+    bool present = _routes[dest].state != Invalid;
+    deleteRoute(dest);
+    return present;
+#else
+    uint16_t i;
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
     {
-	if (_routes[i].dest == dest)
+	if (_routes[i].dest == dest && _routes[i].state != Invalid)
 	{
 	    deleteRoute(i);
 	    return true;
 	}
     }
     return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+// Index of the route longest since it was last heard or used. 
+// Ages are compared rather than times, so millis() wrapping round does no harm
+uint16_t RHRouter::oldestRoute()
+{
+    uint16_t i, oldest = 0;
+    uint32_t now = millis();
+    uint32_t oldestAge = 0;
+    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    {
+	if (_routes[i].state == Invalid)
+	    continue;
+	uint32_t heard = now - _routes[i].lastHeard;
+	uint32_t used = now - _routes[i].lastUsed;
+	uint32_t age = heard < used ? heard : used;
+	if (age >= oldestAge)
+	{
+	    oldest = i;
+	    oldestAge = age;
+	}
+    }
+    return oldest;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::retireOldestRoute()
 {
-    // We just obliterate the first in the table and clear the last
-    deleteRoute(0);
+    deleteRoute(oldestRoute());
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::clearRoutingTable()
 {
-    uint8_t i;
+    uint16_t i;
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    {
+	_routes[i].dest = i;
 	_routes[i].state = Invalid;
+    }
 }
 
 
@@ -175,23 +253,308 @@ uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest,
     _tmpMessage.header.hops = 0;
     _tmpMessage.header.id = _lastE2ESequenceNumber++;
     _tmpMessage.header.flags = flags;
-    memcpy(_tmpMessage.data, buf, len);
+    if (buf != _tmpMessage.data)
+	memcpy(_tmpMessage.data, buf, len);
 
     return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
 }
 
+#if RH_ENABLE_ROUTER_FLOOD
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendtoFlood(uint8_t* buf, uint8_t len, uint8_t flags)
+{
+    // Our own flood comes back as the neighbours rebroadcast it, and floodReceived() ignores it
+    return sendtoFromSourceWait(buf, len, RH_BROADCAST_ADDRESS, _thisAddress, flags | RH_ROUTER_FLAGS_FLOOD);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::setFloodCopies(uint8_t copies)
+{
+    _floodCopies = copies;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::floodReceived(RoutedMessage* message, uint8_t messageLen)
+{
+    if (   message->header.source == _thisAddress
+	|| broadcastSeen(message->header.source, message->header.id))
+	return false;
+
+    // If all the slots are full it is not rebroadcast, but is still delivered
+    if (_isa_router && message->header.hops < _max_hops)
+	rebroadcastLater(message, messageLen);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::broadcastSeen(uint8_t source, uint8_t id)
+{
+    uint8_t i;
+
+    // Another copy of one we are waiting to rebroadcast?
+    for (i = 0; i < RH_ROUTER_FLOOD_SLOTS; i++)
+    {
+	FloodSlot* f = &_floodSlots[i];
+	if (f->pending && f->message.header.source == source && f->message.header.id == id)
+	{
+	    if (f->copies < 0xff)
+		f->copies++;
+	    return true;
+	}
+    }
+    for (i = 0; i < RH_ROUTER_FLOOD_SEEN; i++)
+	if (_floodSeen[i].source == source && _floodSeen[i].id == id)
+	    return true;
+
+    // New, so remember it in place of the oldest
+    _floodSeen[_floodSeenNext].source = source;
+    _floodSeen[_floodSeenNext].id = id;
+    _floodSeenNext = (_floodSeenNext + 1) % RH_ROUTER_FLOOD_SEEN;
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::rebroadcastLater(RoutedMessage* message, uint8_t messageLen, bool suppress)
+{
+    for (uint8_t i = 0; i < RH_ROUTER_FLOOD_SLOTS; i++)
+    {
+	FloodSlot* f = &_floodSlots[i];
+	if (f->pending)
+	    continue;
+	// Wait a random number of message times before rebroadcasting
+	uint32_t slot = _driver.timeOnAir(messageLen);
+	if (slot < RH_ROUTER_FLOOD_MIN_SLOT)
+	    slot = RH_ROUTER_FLOOD_MIN_SLOT;
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+	uint8_t delaySlots = (random() & 0xFF) % RH_ROUTER_FLOOD_DELAY_SLOTS;
+#else
+	uint8_t delaySlots = random(0, RH_ROUTER_FLOOD_DELAY_SLOTS);
+#endif
+	f->pending = true;
+	f->suppress = suppress;
+	f->copies = 1;
+	f->len = messageLen;
+	f->due = millis() + slot * delaySlots;
+	memcpy(&f->message, message, messageLen);
+	f->message.header.hops++;
+	return true;
+    }
+    return false;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHRouter::floodWait(uint16_t timeLeft)
+{
+#if RH_ENABLE_ROUTER_FLOOD
+    for (uint8_t i = 0; i < RH_ROUTER_FLOOD_SLOTS; i++)
+    {
+	FloodSlot* f = &_floodSlots[i];
+	if (!f->pending)
+	    continue;
+	long untilDue = (long)(f->due - millis());
+	if (untilDue <= 0)
+	{
+	    f->pending = false;
+	    // Unless enough copies were heard that the neighbours must have it already
+	    if (!f->suppress || !_floodCopies || f->copies < _floodCopies)
+		route(&f->message, f->len);
+	}
+	else if (untilDue < timeLeft)
+	    timeLeft = untilDue;
+    }
+#endif
+    return timeLeft;
+}
+
+#if RH_ENABLE_ROUTER_QUEUE
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::forwardQueued()
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < RH_ROUTER_QUEUE_LEN; i++)
+	if (_forward[i].state != ForwardFree)
+	    count++;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHRouter::forwardDrops()
+{
+    return _forwardDrops;
+}
+
+////////////////////////////////////////////////////////////////////
+RHRouter::ForwardSlot* RHRouter::forwardSlot(uint8_t priority)
+{
+    ForwardSlot* slot = NULL;
+    uint8_t i;
+    for (i = 0; i < RH_ROUTER_QUEUE_LEN; i++)
+	if (_forward[i].state == ForwardFree)
+	    return &_forward[i];
+    // Full: the tail of a lower priority, if there is one not already being sent
+    for (i = 0; i < RH_ROUTER_QUEUE_LEN; i++)
+    {
+	ForwardSlot* f = &_forward[i];
+	if (   f->state == ForwardQueued
+	    && f->priority < priority
+	    && (!slot || f->priority < slot->priority
+		|| (f->priority == slot->priority && (int8_t)(f->order - slot->order) > 0)))
+	    slot = f;
+    }
+    return slot;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::forward(RoutedMessage* message, uint8_t messageLen, uint8_t from)
+{
+    uint8_t priority = forwardPriority(message, messageLen);
+    ForwardSlot* slot = forwardSlot(priority);
+    if (!slot || slot->state != ForwardFree)
+	_forwardDrops++;
+    if (!slot)
+	return false;
+    slot->state = ForwardQueued;
+    slot->priority = priority;
+    slot->order = _forwardOrder++;
+    slot->from = from;
+    slot->len = messageLen;
+    memcpy(&slot->message, message, messageLen);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+// Refuses messages to forward while the queue is full, so the last hop holds on to them
+bool RHRouter::acceptMessage(uint8_t from, const uint8_t* buf, uint8_t len)
+{
+    (void)from; // Not used
+    RoutedMessage* message = (RoutedMessage*)buf;
+    if (   len < sizeof(RoutedMessageHeader)
+	|| message->header.dest == _thisAddress
+	|| message->header.dest == RH_BROADCAST_ADDRESS
+	|| !_isa_router)
+	return true;
+    return forwardSlot(forwardPriority(message, len)) != NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::forwardPriority(RoutedMessage* message, uint8_t messageLen)
+{
+    (void)message; // Not used
+    (void)messageLen; // Not used
+    return RH_ROUTER_PRIORITY_NORMAL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::forwardFailed(RoutedMessage* message, uint8_t messageLen, uint8_t from)
+{
+    // Default does nothing
+    (void)message; // Not used
+    (void)messageLen; // Not used
+    (void)from; // Not used
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::windowDone(uint8_t address, uint8_t id, bool delivered)
+{
+    for (uint8_t i = 0; i < RH_ROUTER_QUEUE_LEN; i++)
+    {
+	ForwardSlot* f = &_forward[i];
+	if (f->state == ForwardSending && f->next_hop == address && f->id == id)
+	{
+	    // Free the slot first, so what forwardFailed() queues can use it
+	    f->state = ForwardFree;
+	    if (!delivered)
+	    {
+		RoutedMessage failed;
+		memcpy(&failed, &f->message, f->len);
+		forwardFailed(&failed, f->len, f->from);
+	    }
+	    return;
+	}
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHRouter::forwardWait(uint16_t timeLeft)
+{
+#if RH_ENABLE_ROUTER_QUEUE
+    // Fill the windows, highest priority first and oldest first within a priority,
+    // skipping messages whose next hop has no room
+    for (;;)
+    {
+	ForwardSlot* next = NULL;
+	uint8_t next_hop = RH_BROADCAST_ADDRESS;
+	for (uint8_t i = 0; i < RH_ROUTER_QUEUE_LEN; i++)
+	{
+	    ForwardSlot* f = &_forward[i];
+	    if (   f->state != ForwardQueued
+		|| (next && (f->priority < next->priority
+			     || (f->priority == next->priority && (int8_t)(f->order - next->order) > 0))))
+		continue;
+	    uint8_t hop;
+	    if (!nextHop(&f->message, f->len, &hop))
+	    {
+		// Free the slot first, so what forwardFailed() queues can use it
+		RoutedMessage failed;
+		memcpy(&failed, &f->message, f->len);
+		f->state = ForwardFree;
+		forwardFailed(&failed, f->len, f->from);
+		continue;
+	    }
+	    if (windowOutstanding(hop) < windowSize())
+	    {
+		next = f;
+		next_hop = hop;
+	    }
+	}
+	if (!next || !sendtoWindow((uint8_t*)&next->message, next->len, next_hop, &next->id))
+	    break;
+	next->state = ForwardSending;
+	next->next_hop = next_hop;
+    }
+    return windowWait(timeLeft);
+#else
+    return timeLeft;
+#endif
+}
+
+#if RH_ENABLE_RELIABLE_WINDOW
+////////////////////////////////////////////////////////////////////
+// Queues for the next hop without waiting
+uint8_t RHRouter::sendtoFromSourceWindow(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags, uint8_t* next_hop, uint8_t* id)
+{
+    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+
+    // Construct a RH RouterMessage message. The end-to-end ID is only used up once it is queued
+    _tmpMessage.header.source = source;
+    _tmpMessage.header.dest = dest;
+    _tmpMessage.header.hops = 0;
+    _tmpMessage.header.id = _lastE2ESequenceNumber;
+    _tmpMessage.header.flags = flags;
+    if (buf != _tmpMessage.data)
+	memcpy(_tmpMessage.data, buf, len);
+
+    if (!nextHop(&_tmpMessage, sizeof(RoutedMessageHeader)+len, next_hop))
+	return RH_ROUTER_ERROR_NO_ROUTE;
+
+    if (!sendtoWindow((uint8_t*)&_tmpMessage, sizeof(RoutedMessageHeader)+len, *next_hop, id))
+	return RH_ROUTER_ERROR_QUEUE_FULL;
+    _lastE2ESequenceNumber++;
+    return RH_ROUTER_ERROR_NONE;
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////
 uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
 {
     // Reliably deliver it if possible. See if we have a route:
     uint8_t next_hop = RH_BROADCAST_ADDRESS;
-    if (message->header.dest != RH_BROADCAST_ADDRESS)
-    {
-	RoutingTableEntry* route = getRouteTo(message->header.dest);
-	if (!route)
-	    return RH_ROUTER_ERROR_NO_ROUTE;
-	next_hop = route->next_hop;
-    }
+    if (   message->header.dest != RH_BROADCAST_ADDRESS
+	&& !nextHop(message, messageLen, &next_hop))
+	return RH_ROUTER_ERROR_NO_ROUTE;
 
     if (!RHReliableDatagram::sendtoWait((uint8_t*)message, messageLen, next_hop))
 	return RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
@@ -199,6 +562,18 @@ uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
     return RH_ROUTER_ERROR_NONE;
 }
 
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override this to route some messages without the routing table
+bool RHRouter::nextHop(RoutedMessage* message, uint8_t messageLen, uint8_t* next_hop)
+{
+    (void)messageLen; // Not used
+    RoutingTableEntry* route = getRouteTo(message->header.dest);
+    if (!route)
+	return false;
+    *next_hop = route->next_hop;
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 // Subclasses may want to override this to peek at messages going past
 void RHRouter::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
@@ -216,6 +591,10 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
     uint8_t _to;
     uint8_t _id;
     uint8_t _flags;
+    floodWait(0);
+    // Forward between receptions
+    if (!available())
+	forwardWait(0);
     if (RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags))
     {
 	// Here we simulate networks with limited visibility between nodes
@@ -271,6 +650,13 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	// See if its for us or has to be routed
 	if (_tmpMessage.header.dest == _thisAddress || _tmpMessage.header.dest == RH_BROADCAST_ADDRESS)
 	{
+#if RH_ENABLE_ROUTER_FLOOD
+	    // A flood is delivered once, however many neighbours rebroadcast it
+	    if (   _tmpMessage.header.dest == RH_BROADCAST_ADDRESS
+		&& (_tmpMessage.header.flags & RH_ROUTER_FLAGS_FLOOD)
+		&& !floodReceived(&_tmpMessage, tmpMessageLen))
+		return false;
+#endif
 	    // Deliver it here
 	    if (source) *source  = _tmpMessage.header.source;
 	    if (dest)   *dest    = _tmpMessage.header.dest;
@@ -280,7 +666,8 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	    uint8_t msgLen = tmpMessageLen - sizeof(RoutedMessageHeader);
 	    if (*len > msgLen)
 		*len = msgLen;
-	    memcpy(buf, _tmpMessage.data, *len);
+	    if (buf != _tmpMessage.data)
+		memcpy(buf, _tmpMessage.data, *len);
 	    return true; // Its for you!
 	}
 	else if (   _tmpMessage.header.dest != RH_BROADCAST_ADDRESS
@@ -292,7 +679,12 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	    
 	    // If we are forwarding packets, do so. Otherwise, drop.
 	    if (_isa_router)
+#if RH_ENABLE_ROUTER_QUEUE
+		// Sent by forwardWait(), so we can go on receiving meanwhile
+		forward(&_tmpMessage, tmpMessageLen, _from);
+#else
 	        route(&_tmpMessage, tmpMessageLen);
+#endif
 	}
 	// Discard it and maybe wait for another
     }
@@ -306,7 +698,7 @@ bool RHRouter::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout,
     int32_t timeLeft;
     while ((timeLeft = timeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	if (available() || waitAvailableTimeout(forwardWait(floodWait(ackWait(timeLeft)))))
 	{
 	    if (recvfromAck(buf, len, source, dest, id, flags, hops))
 		return true;
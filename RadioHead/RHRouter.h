@@ -12,8 +12,74 @@
 // Default max number of hops we will route
 #define RH_DEFAULT_MAX_HOPS 30
 
-// The default size of the routing table we keep
-#define RH_ROUTING_TABLE_SIZE 10
+// The default size of the routing table we keep. With 256 entries the table is indexed
+// directly by destination address, so lookups take constant time and no route is ever evicted.
+// Smaller tables are searched, and when full the least recently active route makes room.
+#ifndef RH_ROUTING_TABLE_SIZE
+ #if defined(__AVR__)
+  #define RH_ROUTING_TABLE_SIZE 10
+ #else
+  #define RH_ROUTING_TABLE_SIZE 256
+ #endif
+#endif
+
+// This macro enables flooding with sendtoFlood(): broadcasts that every router rebroadcasts once,
+// so they reach the whole network. It needs RH_ROUTER_FLOOD_SLOTS message buffers of RH_MAX_MESSAGE_LEN
+// octets, so it defaults to off on AVR. Override it in your code to change that.
+#ifndef RH_ENABLE_ROUTER_FLOOD
+ #if defined(__AVR__)
+  #define RH_ENABLE_ROUTER_FLOOD 0
+ #else
+  #define RH_ENABLE_ROUTER_FLOOD 1
+ #endif
+#endif
+
+// Number of received floods that can wait for their rebroadcast at once
+#ifndef RH_ROUTER_FLOOD_SLOTS
+ #define RH_ROUTER_FLOOD_SLOTS 4
+#endif
+
+// Number of recent floods remembered by SOURCE and ID, so each is delivered and rebroadcast only once
+#ifndef RH_ROUTER_FLOOD_SEEN
+ #define RH_ROUTER_FLOOD_SEEN 32
+#endif
+
+// Rebroadcasts wait a random number of message times, up to this many, so that
+// the neighbours that heard a flood together don't all rebroadcast it together
+#ifndef RH_ROUTER_FLOOD_DELAY_SLOTS
+ #define RH_ROUTER_FLOOD_DELAY_SLOTS 8
+#endif
+
+// The message time in milliseconds used for the rebroadcast delay when the driver can't
+// compute its time on air, and the least it may be otherwise
+#define RH_ROUTER_FLOOD_MIN_SLOT 20
+
+// By default a flood is not rebroadcast if this many copies of it were heard while it waited
+#define RH_DEFAULT_FLOOD_COPIES 3
+
+// Set in the RHRouter header FLAGS of messages sent by sendtoFlood(). Not for application use.
+#define RH_ROUTER_FLAGS_FLOOD 0x80
+
+// This macro enables the forwarding queue: messages this node relays for others are queued and
+// sent through the RHReliableDatagram window to their next hop, instead of waiting there and then
+// for the next hop to acknowledge them. It needs RH_ENABLE_RELIABLE_WINDOW and RH_ROUTER_QUEUE_LEN
+// message buffers of RH_MAX_MESSAGE_LEN octets, so it defaults to off on AVR.
+#ifndef RH_ENABLE_ROUTER_QUEUE
+ #if defined(__AVR__) || !RH_ENABLE_RELIABLE_WINDOW
+  #define RH_ENABLE_ROUTER_QUEUE 0
+ #else
+  #define RH_ENABLE_ROUTER_QUEUE 1
+ #endif
+#endif
+
+// Number of messages the forwarding queue holds, across all next hops
+#ifndef RH_ROUTER_QUEUE_LEN
+ #define RH_ROUTER_QUEUE_LEN 8
+#endif
+
+// Priorities of forwarded messages, see forwardPriority()
+#define RH_ROUTER_PRIORITY_NORMAL  0
+#define RH_ROUTER_PRIORITY_CONTROL 1
 
 // Error codes
 #define RH_ROUTER_ERROR_NONE              0
@@ -22,6 +88,7 @@
 #define RH_ROUTER_ERROR_TIMEOUT           3
 #define RH_ROUTER_ERROR_NO_REPLY          4
 #define RH_ROUTER_ERROR_UNABLE_TO_DELIVER 5
+#define RH_ROUTER_ERROR_QUEUE_FULL        6
 
 // This size of RH_ROUTER_MAX_MESSAGE_LEN is OK for Arduino Mega, but too big for
 // Duemilanove. Size of 50 works with the sample router programs on Duemilanove.
@@ -91,9 +158,46 @@
 /// You can also use addRouteTo() to change a route and 
 /// deleteRouteTo() to delete a route at run time. Youcan also clear the entire routing table
 ///
-/// The Routing Table has limited capacity for entries (defined by RH_ROUTING_TABLE_SIZE, which is 10)
-/// if more than RH_ROUTING_TABLE_SIZE are added, the oldest (first) one will be removed by calling 
-/// retireOldestRoute()
+/// The Routing Table holds RH_ROUTING_TABLE_SIZE entries. By default that is 256, one for every
+/// possible address, and the table is indexed directly by destination address.
+/// On AVR it defaults to 10. There, if more than RH_ROUTING_TABLE_SIZE routes are added, the least
+/// recently active one (the one longest since it was last added, updated or looked up) is removed
+/// by calling retireOldestRoute()
+///
+/// \par Buffers
+///
+/// Each instance builds the messages it sends in its own buffer, leaving room at the start for the
+/// RHRouter header, and receives into it. Subclasses such as RHMesh add their own headers to the data in place,
+/// so a message is copied once on the way from the application to the driver, and once on the way
+/// back, however many layers it passes through. As there is no buffer shared between instances, separate
+/// instances, each with its own driver, can be driven from separate threads. Each instance must only be
+/// used by one thread at a time.
+///
+/// \par Forwarding
+///
+/// Without RH_ENABLE_ROUTER_QUEUE a router relays a message for another node from within recvfromAck(),
+/// which waits until the next hop acknowledges it or the retries run out. It can't receive anything
+/// meanwhile, and whatever arrives is lost. With it, which is the default except on AVR, the message
+/// is put in a queue of RH_ROUTER_QUEUE_LEN messages, and recvfromAck() returns at once. Whenever no message
+/// is waiting to be received, queued messages move to the RHReliableDatagram window of their next hop,
+/// which sends them in bursts and retransmits those that are not acknowledged, so each next hop has
+/// its own queue and one slow neighbour does not hold up the others. Messages with a higher
+/// forwardPriority(), such as RHMesh route discovery replies, go first. When the queue is full a new
+/// message takes the place of the newest one of lower priority, which is dropped and counted in forwardDrops().
+/// If there is none it is not acknowledged, so the node it came from keeps it and retransmits it later.
+///
+/// \par Flooding
+///
+/// Messages sent to RH_BROADCAST_ADDRESS by sendtoWait() reach only the nodes in range of the sender.
+/// Messages sent by sendtoFlood() are rebroadcast by every router that hears them, so they reach
+/// every node within max_hops (see setMaxHops()). Each node remembers the SOURCE and ID of the last
+/// RH_ROUTER_FLOOD_SEEN floods, and delivers and rebroadcasts each flood only once however many of
+/// its neighbours rebroadcast it. To keep neighbours from rebroadcasting at the same time, and to
+/// keep dense networks from repeating the same flood over and over, each router waits a random
+/// delay before rebroadcasting, and skips the rebroadcast if it has meanwhile heard the flood
+/// setFloodCopies() times: its neighbours have then already been covered.
+/// The rebroadcasts are sent while recvfromAck() or recvfromAckTimeout() is called, so call them frequently.
+/// Requires RH_ENABLE_ROUTER_FLOOD, which is off on AVR.
 ///
 /// \par Message Format
 ///
@@ -109,7 +213,7 @@
 /// - 1 octet HOPS, the number of hops this message has traversed so far.
 /// - 1 octet ID, an incrementing message ID for end-to-end message tracking for use by subclasses. 
 ///   Not used by RHRouter.
-/// - 1 octet FLAGS, a bitmask for use by subclasses. Not used by RHRouter.
+/// - 1 octet FLAGS, a bitmask for use by subclasses. RHRouter uses only RH_ROUTER_FLAGS_FLOOD.
 /// - 0 or more octets DATA, the application payload data. The length of this data is implicit 
 ///   in the length of the entire message.
 ///
@@ -156,7 +260,7 @@ public:
     typedef enum
     {
 	Invalid = 0,           ///< No valid route is known
-	Discovering,           ///< Discovering a route (not currently used)
+	Discovering,           ///< Rediscovering a route, which is still used until it expires or is replaced
 	Valid                  ///< Route is valid
     } RouteState;
 
@@ -166,6 +270,9 @@ public:
 	uint8_t      dest;      ///< Destination node address
 	uint8_t      next_hop;  ///< Send via this next hop address
 	uint8_t      state;     ///< State of this route, one of RouteState
+	uint8_t      cost;      ///< Path cost to dest in units of 1/RH_ETX_UNIT transmissions, 0 if unknown
+	uint32_t     lastHeard; ///< millis() when the route was last added or updated by addRouteTo()
+	uint32_t     lastUsed;  ///< millis() when the route was last looked up by getRouteTo()
     } RoutingTableEntry;
 
     /// Constructor. 
@@ -194,15 +301,18 @@ public:
     void setMaxHops(uint8_t max_hops);
 
     /// Adds a route to the local routing table, or updates it if already present.
-    /// If there is not enough room the oldest (first) route will be deleted by calling retireOldestRoute().
+    /// If there is not enough room the least recently active route will be deleted by calling retireOldestRoute().
+    /// Sets the lastHeard time of the route.
     /// \param [in] dest The destination node address. RH_BROADCAST_ADDRESS is permitted.
     /// \param [in] next_hop The address of the next hop to send messages destined for dest
     /// \param [in] state The satte of the route. Defaults to Valid
-    void addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state = Valid);
+    /// \param [in] cost The path cost to dest, see RoutingTableEntry. Defaults to 0, unknown
+    void addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state = Valid, uint8_t cost = 0);
 
-    /// Finds and returns a RoutingTableEntry for the given destination node
+    /// Finds and returns a RoutingTableEntry for the given destination node, and sets its lastUsed time.
+    /// A route older than routeLifetime() has expired and is deleted instead.
     /// \param [in] dest The desired destination node address.
-    /// \return pointer to a RoutingTableEntry for dest
+    /// \return pointer to a RoutingTableEntry for dest, or NULL if there is no route to dest
     RoutingTableEntry* getRouteTo(uint8_t dest);
 
     /// Deletes from the local routing table any route for the destination node.
@@ -210,8 +320,18 @@ public:
     /// \return true if the route was present
     bool deleteRouteTo(uint8_t dest);
 
-    /// Deletes the oldest (first) route from the 
-    /// local routing table
+    /// Sets how long a route lasts after it was last added or updated by addRouteTo().
+    /// getRouteTo() deletes and does not return a route older than this. Defaults to 0, for
+    /// routes that last until they are deleted, but RHMesh gives its routes a lifetime.
+    /// \param [in] lifetime The route lifetime in milliseconds, or 0 for routes that never expire
+    void setRouteLifetime(uint32_t lifetime);
+
+    /// Returns the route lifetime set by setRouteLifetime()
+    /// \return The route lifetime in milliseconds, or 0 if routes never expire
+    uint32_t routeLifetime();
+
+    /// Deletes the least recently active route from the 
+    /// local routing table: the one longest since it was last heard or used
     void retireOldestRoute();
 
     /// Clears all entries from the 
@@ -256,6 +376,37 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
 
+#if RH_ENABLE_ROUTER_FLOOD
+    /// Floods a message to every node within max_hops. It is broadcast at once, without
+    /// waiting for an acknowledgement, and then rebroadcast by the routers that hear it.
+    /// The receivers get it from recvfromAck() once each, with DEST set to RH_BROADCAST_ADDRESS
+    /// and RH_ROUTER_FLAGS_FLOOD set in the FLAGS.
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] flags Optional flags for use by subclasses or application layer, 
+    ///             delivered end-to-end. Must not include RH_ROUTER_FLAGS_FLOOD.
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE Message was broadcast
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH Message is too long
+    ///         - RH_ROUTER_ERROR_UNABLE_TO_DELIVER Message could not be transmitted
+    uint8_t sendtoFlood(uint8_t* buf, uint8_t len, uint8_t flags = 0);
+
+    /// Sets how many copies of a flood this node may hear while it waits to rebroadcast it
+    /// before it skips the rebroadcast. Lower values save airtime in dense networks, higher ones
+    /// make floods more likely to get round obstacles. Defaults to RH_DEFAULT_FLOOD_COPIES.
+    /// \param [in] copies The number of copies, counting the first one heard. 0 always rebroadcasts.
+    void setFloodCopies(uint8_t copies);
+#endif
+
+#if RH_ENABLE_ROUTER_QUEUE
+    /// Returns the number of messages in the forwarding queue, waiting for their next hop or its acknowledgement
+    uint8_t forwardQueued();
+
+    /// Returns the number of messages for other nodes that the forwarding queue dropped for lack of room,
+    /// since starting. Messages refused before they were acknowledged are not counted, as their senders still have them.
+    uint32_t forwardDrops();
+#endif
+
     /// Starts the receiver if it is not running already.
     /// If there is a valid message available for this node (or RH_BROADCAST_ADDRESS), 
     /// send an acknowledgement to the last hop
@@ -310,10 +461,104 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
-    /// Deletes a specific rout entry from therouting table
-    /// \param [in] index The 0 based index of the routing table entry to delete
+    /// Finds the next hop for a message to a single node, by looking up its DEST in the routing table.
+    /// Called by route(), and when forwarding or queueing messages with a window.
+    /// This is virtual, which lets subclasses route some messages some other way.
+    /// \param [in] message Pointer to the RHRouter message to be sent.
+    /// \param [in] messageLen Length of message in octets
+    /// \param [out] next_hop Set to the address of the next hop
+    /// \return false if there is no route
+    virtual bool nextHop(RoutedMessage* message, uint8_t messageLen, uint8_t* next_hop);
+
+    /// Rebroadcasts the received floods whose delay has expired, and returns how long a caller about
+    /// to wait for a message may wait before it has to call this again
+    /// \param[in] timeLeft How long the caller wants to wait, in milliseconds
+    /// \return The lesser of timeLeft and the time until the next rebroadcast is due
+    uint16_t floodWait(uint16_t timeLeft);
+
+#if RH_ENABLE_ROUTER_FLOOD
+    /// Checks a received broadcast against the broadcasts seen recently by SOURCE and ID, as floods are.
+    /// A copy of one waiting in rebroadcastLater() counts towards setFloodCopies(). A new one is remembered.
+    /// Subclasses can use this for broadcasts of their own that every router relays once.
+    /// \param [in] source The originator node address
+    /// \param [in] id The originator sequence number
+    /// \return true if it has been seen before
+    bool broadcastSeen(uint8_t source, uint8_t id);
+
+    /// Queues a message to be broadcast again after a random delay of up to RH_ROUTER_FLOOD_DELAY_SLOTS
+    /// message times, adding this node to its HOPS. floodWait() sends it, unless suppress is true and
+    /// setFloodCopies() copies of it were counted by broadcastSeen() meanwhile.
+    /// \param [in] message Pointer to the message, with the SOURCE and ID broadcastSeen() was given
+    /// \param [in] messageLen Length of message in octets
+    /// \param [in] suppress false to send it however many copies are heard
+    /// \return false if all RH_ROUTER_FLOOD_SLOTS are in use, and it will not be sent
+    bool rebroadcastLater(RoutedMessage* message, uint8_t messageLen, bool suppress = true);
+#endif
+
+    /// Moves messages from the forwarding queue to the window of their next hop, sends them with
+    /// RHReliableDatagram::windowWait() and returns how long a caller about to wait for a message
+    /// may wait before it has to call this again
+    /// \param[in] timeLeft How long the caller wants to wait, in milliseconds
+    /// \return The lesser of timeLeft and the time until the next retransmission is due
+    uint16_t forwardWait(uint16_t timeLeft);
+
+#if RH_ENABLE_ROUTER_QUEUE
+    /// Puts a message for another node in the forwarding queue. If the queue is full, the message
+    /// replaces the newest queued one of lower forwardPriority(), else it is dropped.
+    /// \param [in] message Pointer to the RHRouter message to forward. It is copied
+    /// \param [in] messageLen Length of message in octets
+    /// \param [in] from The node the message came from, or this node's address
+    /// \return true if the message was queued
+    bool forward(RoutedMessage* message, uint8_t messageLen, uint8_t from);
+
+    /// Returns the priority of a message put in the forwarding queue. Messages of higher priority
+    /// are sent first, and may replace ones of lower priority when the queue is full.
+    /// Subclasses may override this. The default returns RH_ROUTER_PRIORITY_NORMAL.
+    /// \param [in] message Pointer to the RHRouter message
+    /// \param [in] messageLen Length of message in octets
+    /// \return The priority, such as RH_ROUTER_PRIORITY_NORMAL or RH_ROUTER_PRIORITY_CONTROL
+    virtual uint8_t forwardPriority(RoutedMessage* message, uint8_t messageLen);
+
+    /// Called when a message in the forwarding queue has no route, or its next hop did not acknowledge it.
+    /// Subclasses may override this to repair the route. The default does nothing.
+    /// \param [in] message Pointer to the RHRouter message that was not forwarded
+    /// \param [in] messageLen Length of message in octets
+    /// \param [in] from The node the message came from
+    virtual void forwardFailed(RoutedMessage* message, uint8_t messageLen, uint8_t from);
+
+    /// Refuses a message that is to be forwarded while the forwarding queue has no room for it,
+    /// so the last hop keeps it and retransmits it later instead of it being dropped here
+    virtual bool acceptMessage(uint8_t from, const uint8_t* buf, uint8_t len);
+
+    /// Frees the forwarding queue entry that the windowed message was carrying.
+    /// Subclasses that override this must call it.
+    virtual void windowDone(uint8_t address, uint8_t id, bool delivered);
+#endif
+
+    /// Deletes a specific rout entry from therouting table. The other entries do not move.
+    /// \param [in] index The 0 based index of the routing table entry to delete. With the
+    /// default 256 entry table this is the destination address.
     void deleteRoute(uint8_t index);
 
+#if RH_ENABLE_RELIABLE_WINDOW
+    /// Like sendtoFromSourceWait(), but queues the message for the next hop with
+    /// RHReliableDatagram::sendtoWindow() instead of waiting for the next hop to acknowledge it.
+    /// The message is transmitted by pollWindow(), and windowDone() reports what became of it.
+    /// \param [in] buf The application message data
+    /// \param [in] len Number of octets in the application message data
+    /// \param [in] dest The destination node address. Must not be RH_BROADCAST_ADDRESS
+    /// \param [in] source The (fake) originating node address
+    /// \param [in] flags Flags delivered end-to-end to the dest address
+    /// \param [out] next_hop Set to the next hop the message was queued for
+    /// \param [out] id Set to the ID the message will be sent to the next hop with
+    /// \return The result code:
+    ///         - RH_ROUTER_ERROR_NONE Message was queued for the next hop
+    ///         - RH_ROUTER_ERROR_INVALID_LENGTH Message is too long
+    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest in the local routing table
+    ///         - RH_ROUTER_ERROR_QUEUE_FULL The window to the next hop is full, try again later
+    uint8_t sendtoFromSourceWindow(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags, uint8_t* next_hop, uint8_t* id);
+#endif
+
     /// The last end-to-end sequence number to be used
     /// Defaults to 0
     uint8_t _lastE2ESequenceNumber;
@@ -325,10 +570,94 @@ protected:
     /// Flag to set if packets are forwarded or not
     bool _isa_router;
 
+    /// How long routes last after they were added or updated (milliseconds), 0 for ever
+    uint32_t _routeLifetime;
+
+    /// Message buffer, in which messages are built to send and received.
+    /// Subclasses can build their messages in place in its data, and pass that as buf to sendtoFromSourceWait(),
+    /// sendtoFromSourceWindow() or recvfromAck(), which then don't copy it.
+    RoutedMessage _tmpMessage;
+
 private:
 
-    /// Temporary mesage buffer
-    static RoutedMessage _tmpMessage;
+    /// Returns the index of the valid route longest since it was last heard or used,
+    /// or 0 if there are none
+    uint16_t oldestRoute();
+
+#if RH_ENABLE_ROUTER_FLOOD
+    /// Defines a flood remembered so it is not delivered or rebroadcast again
+    typedef struct
+    {
+	uint8_t      source;    ///< Originator node address
+	uint8_t      id;        ///< Originator sequence number
+    } FloodSeen;
+
+    /// Defines a received flood waiting to be rebroadcast
+    typedef struct
+    {
+	bool          pending;  ///< The slot holds a flood to rebroadcast
+	bool          suppress; ///< Not rebroadcast if enough copies are heard
+	uint8_t       copies;   ///< Number of copies heard so far
+	uint8_t       len;      ///< Length of message in octets
+	unsigned long due;      ///< millis() when it is to be rebroadcast
+	RoutedMessage message;  ///< The flood, with its HOPS already counting this node
+    } FloodSlot;
+
+    /// Checks a received flood with broadcastSeen(). If it is new and this node is a router,
+    /// schedules its rebroadcast with rebroadcastLater().
+    /// \param [in] message Pointer to the flood that was received
+    /// \param [in] messageLen Length of message in octets
+    /// \return true if the flood is new and is to be delivered
+    bool floodReceived(RoutedMessage* message, uint8_t messageLen);
+
+    /// Floods seen recently, used as a ring
+    FloodSeen            _floodSeen[RH_ROUTER_FLOOD_SEEN];
+
+    /// Where the next flood seen goes in _floodSeen
+    uint8_t              _floodSeenNext;
+
+    /// Floods waiting to be rebroadcast
+    FloodSlot            _floodSlots[RH_ROUTER_FLOOD_SLOTS];
+
+    /// Copies of a flood that cancel its rebroadcast, 0 for none
+    uint8_t              _floodCopies;
+#endif
+
+#if RH_ENABLE_ROUTER_QUEUE
+    /// States of a forwarding queue entry
+    typedef enum
+    {
+	ForwardFree = 0,       ///< Entry is unused
+	ForwardQueued,         ///< Message is waiting for room in the window of its next hop
+	ForwardSending         ///< Message is in the window of next_hop, waiting for its ACK
+    } ForwardState;
+
+    /// A message in the forwarding queue
+    typedef struct
+    {
+	uint8_t       state;    ///< One of ForwardState
+	uint8_t       priority; ///< From forwardPriority()
+	uint8_t       order;    ///< When it was queued, for first in first out within a priority
+	uint8_t       from;     ///< The node it came from
+	uint8_t       next_hop; ///< The next hop, once ForwardSending
+	uint8_t       id;       ///< The ID in the window of next_hop, once ForwardSending
+	uint8_t       len;      ///< Length of message in octets
+	RoutedMessage message;  ///< The message, with its HOPS already counting this node
+    } ForwardSlot;
+
+    /// Returns a free forwarding queue entry, else the newest queued one of lower priority than priority
+    /// \return The entry, or NULL if there is none
+    ForwardSlot* forwardSlot(uint8_t priority);
+
+    /// The forwarding queue
+    ForwardSlot          _forward[RH_ROUTER_QUEUE_LEN];
+
+    /// The order given to the next message queued
+    uint8_t              _forwardOrder;
+
+    /// Count of messages dropped because the forwarding queue was full
+    uint32_t             _forwardDrops;
+#endif
 
     /// Local routing table
     RoutingTableEntry    _routes[RH_ROUTING_TABLE_SIZE];
@@ -38,6 +38,8 @@ RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi
     _myInterruptIndex = 0xff; // Not allocated yet
     _enableCRC = true;
     _useRFO = false;
+    _headerLen = RH_RF95_HEADER_LEN;
+    _implicitLen = 0;
 }
 
 bool RH_RF95::init()
@@ -275,13 +277,24 @@ void RH_INTERRUPT_ATTR RH_RF95::isr2()
 // Check whether the latest received message is complete and uncorrupted
 void RH_RF95::validateRxBuf()
 {
-    if (_bufLen < 4)
+    if (_bufLen < _headerLen)
 	return; // Too short to be a real message
-    // Extract the 4 headers
-    _rxHeaderTo    = _buf[0];
-    _rxHeaderFrom  = _buf[1];
-    _rxHeaderId    = _buf[2];
-    _rxHeaderFlags = _buf[3];
+    if (_headerLen == RH_RF95_COMPACT_HEADER_LEN)
+    {
+	// Compact headers carry only FROM and FLAGS
+	_rxHeaderTo    = RH_BROADCAST_ADDRESS;
+	_rxHeaderFrom  = _buf[0];
+	_rxHeaderId    = 0;
+	_rxHeaderFlags = _buf[1];
+    }
+    else
+    {
+	// Extract the 4 headers
+	_rxHeaderTo    = _buf[0];
+	_rxHeaderFrom  = _buf[1];
+	_rxHeaderId    = _buf[2];
+	_rxHeaderFlags = _buf[3];
+    }
     if (_promiscuous ||
 	_rxHeaderTo == _thisAddress ||
 	_rxHeaderTo == RH_BROADCAST_ADDRESS)
@@ -324,10 +337,10 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     if (buf && len)
     {
 	ATOMIC_BLOCK_START;
-	// Skip the 4 headers that are at the beginning of the rxBuf
-	if (*len > _bufLen-RH_RF95_HEADER_LEN)
-	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
+	// Skip the headers that are at the beginning of the rxBuf
+	if (*len > _bufLen-_headerLen)
+	    *len = _bufLen-_headerLen;
+	memcpy(buf, _buf+_headerLen, *len);
 	ATOMIC_BLOCK_END;
     }
     clearRxBuf(); // This message accepted and cleared
@@ -337,7 +350,7 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
 
 bool RH_RF95::send(const uint8_t* data, uint8_t len)
 {
-    if (len > RH_RF95_MAX_MESSAGE_LEN)
+    if (!canSend(len))
 	return false;
 
     //waitPacketSent(); // Make sure we dont interrupt an outgoing message
@@ -348,22 +361,60 @@ bool RH_RF95::send(const uint8_t* data, uint8_t len)
      //Serial.println("return false");
 	return false;  // Check channel activity
     }
+    startTransmit(data, len);
+    return true;
+}
+
+bool RH_RF95::sendReply(const uint8_t* data, uint8_t len)
+{
+    if (!canSend(len))
+	return false;
+
+    // The message being replied to has just been received, so nothing can be transmitting
+    // and the channel is known to be ours: no CAD
+    waitPacketSent(5000);
+    setModeIdle();
+    startTransmit(data, len);
+    return true;
+}
+
+bool RH_RF95::canSend(uint8_t len)
+{
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+    // Compact headers have no TO, and implicit headers no length
+    if (_headerLen == RH_RF95_COMPACT_HEADER_LEN && _txHeaderTo != RH_BROADCAST_ADDRESS)
+	return false;
+    if (_implicitLen && len != _implicitLen)
+	return false;
+    return true;
+}
+
+void RH_RF95::startTransmit(const uint8_t* data, uint8_t len)
+{
     // Position at the beginning of the FIFO
     spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
     // The headers
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderTo);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFrom);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderId);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFlags);
+    if (_headerLen == RH_RF95_HEADER_LEN)
+    {
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderTo);
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFrom);
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderId);
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFlags);
+    }
+    else
+    {
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFrom);
+	spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFlags);
+    }
     // The message data
     spiBurstWrite(RH_RF95_REG_00_FIFO, data, len);
-    spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
+    spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + _headerLen);
     
     RH_MUTEX_LOCK(lock); // Multithreading support
     setModeTx(); // Start the transmitter
     RH_MUTEX_UNLOCK(lock);
     // when Tx is done, interruptHandler will fire and radio mode will return to STANDBY
-    return true;
 }
 
 bool RH_RF95::printRegisters()
@@ -489,7 +540,8 @@ void RH_RF95::setTxPower(int8_t power, bool useRFO)
 // Sets registers from a canned modem configuration structure
 void RH_RF95::setModemRegisters(const ModemConfig* config)
 {
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1,       config->reg_1d);
+    // Keep implicit header mode, which belongs to the packet format rather than the modulation
+    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1,       (config->reg_1d & ~RH_RF95_IMPLICIT_HEADER_MODE_ON) | (_implicitLen ? RH_RF95_IMPLICIT_HEADER_MODE_ON : 0));
     spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2,       config->reg_1e);
     spiWrite(RH_RF95_REG_26_MODEM_CONFIG3,       config->reg_26);
 }
@@ -585,6 +637,38 @@ int RH_RF95::lastSNR()
     return _lastSNR;
 }
 
+uint32_t RH_RF95::timeOnAir(uint8_t len)
+{
+    uint8_t reg_1d = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1);
+    uint8_t reg_1e = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2);
+    uint8_t reg_26 = spiRead(RH_RF95_REG_26_MODEM_CONFIG3);
+    uint16_t preamble = spiRead(RH_RF95_REG_20_PREAMBLE_MSB);
+    preamble = (preamble << 8) | spiRead(RH_RF95_REG_21_PREAMBLE_LSB);
+
+    float bw_tab[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+    uint8_t bwindex = reg_1d >> 4;
+    if (bwindex >= (sizeof(bw_tab) / sizeof(float)))
+	return 0; // not defined
+
+    uint8_t sf = reg_1e >> 4;			       		// sf is in bits 7..4
+    uint8_t cr = (reg_1d & RH_RF95_CODING_RATE) >> 1;   	// 1..4 for 4/5..4/8
+    bool implicitHeader = reg_1d & RH_RF95_IMPLICIT_HEADER_MODE_ON;
+    bool crc = reg_1e & RH_RF95_PAYLOAD_CRC_ON;
+    bool lowDataRate = reg_26 & RH_RF95_LOW_DATA_RATE_OPTIMIZE;
+
+    float symbolTime = 1000.0 * (1L << sf) / bw_tab[bwindex]; // ms
+
+    // Payload symbols: 8, plus blocks of (cr + 4) symbols each carrying 4 * (sf - 2 * lowDataRate) bits
+    // of payload, header, CRC and the fixed 28 bit overhead
+    int32_t bits = 8 * (int32_t)(len + _headerLen) - 4 * sf + 28 + (crc ? 16 : 0) - (implicitHeader ? 20 : 0);
+    int32_t bitsPerBlock = 4 * (sf - (lowDataRate ? 2 : 0));
+    int32_t blocks = bits > 0 ? (bits + bitsPerBlock - 1) / bitsPerBlock : 0;
+
+    // The preamble is sent with 4.25 symbols of sync word
+    float symbols = preamble + 4.25 + 8 + blocks * (cr + 4);
+    return (uint32_t)ceil(symbols * symbolTime);
+}
+
  ///////////////////////////////////////////////////
  //
  // additions below by Brian Norman 9th Nov 2018
@@ -711,6 +795,30 @@ void RH_RF95::setPayloadCRC(bool on)
 	spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, current);
     _enableCRC = on;
 }
+
+void RH_RF95::setCompactHeader(bool compact)
+{
+    _headerLen = compact ? RH_RF95_COMPACT_HEADER_LEN : RH_RF95_HEADER_LEN;
+    if (_implicitLen)
+	spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, _implicitLen + _headerLen);
+}
+
+bool RH_RF95::setImplicitHeader(uint8_t len)
+{
+    if (len > RH_RF95_MAX_MESSAGE_LEN)
+	return false;
+    _implicitLen = len;
+    // Implicit header mode is bit 0 of register 1D. The receiver takes the packet length from register 22
+    uint8_t current = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_IMPLICIT_HEADER_MODE_ON;
+    if (len)
+    {
+	spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + _headerLen);
+	spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, current | RH_RF95_IMPLICIT_HEADER_MODE_ON);
+    }
+    else
+	spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, current);
+    return true;
+}
  
 uint8_t RH_RF95::getDeviceVersion()
 {
@@ -29,6 +29,9 @@
 // The headers are inside the LORA's payload
 #define RH_RF95_HEADER_LEN 4
 
+// The length of the headers in compact header mode, see setCompactHeader()
+#define RH_RF95_COMPACT_HEADER_LEN 2
+
 // This is the maximum message length that can be supported by this driver. 
 // Can be pre-defined to a smaller size (to save SRAM) prior to including this header
 // Here we allow for 1 byte message length, 4 bytes headers, user data and 2 bytes of FCS
@@ -319,6 +322,10 @@
 /// - 0 to 251 octets DATA 
 /// - CRC (default CCITT, handled internally by the radio)
 ///
+/// In compact header mode (see setCompactHeader()) the HEADER is 2 octets: (FROM, FLAGS).
+/// TO is always the broadcast address and ID is not sent. In implicit header mode (see setImplicitHeader())
+/// the radio sends no explicit header: every packet has the same length, known to the receiver beforehand.
+///
 /// \par Connecting RFM95/96/97/98 and Semtech SX1276/77/78/79 to Arduino
 ///
 /// We tested with Anarduino MiniWirelessLoRA, which is an Arduino Duemilanove compatible with a RFM96W
@@ -687,6 +694,14 @@ public:
     /// if CAD was requested and the CAD timeout timed out before clear channel was detected.
     virtual bool    send(const uint8_t* data, uint8_t len);
 
+    /// Sends a reply to a node that is listening for it, such as an acknowledgement.
+    /// Unlike send() it never waits for CAD, so the only work between the end of the
+    /// received message and the reply's preamble is loading the FIFO.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send
+    /// \return true if the message length was valid and it was correctly queued for transmit
+    virtual bool    sendReply(const uint8_t* data, uint8_t len);
+
     /// Sets the length of the preamble
     /// in bytes. 
     /// Caution: this should be set to the same 
@@ -786,6 +801,15 @@ public:
     /// \return SNR of the last received message in dB
     int lastSNR();
 
+    /// Returns the time on air of a message with the current modulation settings.
+    /// Reads the spreading factor, bandwidth, coding rate, header mode, CRC, low data rate optimisation
+    /// and preamble length back from the radio, so it follows setModemConfig(), setModemRegisters()
+    /// and the individual setters below. Computed as in the Semtech SX1276 datasheet section 4.1.1.7.
+    /// \param[in] len Number of octets that would be passed to send(). The RH_RF95 header, compact or not, is added here.
+    /// \return Time on air in milliseconds, rounded up. If the modem bandwidth selector in
+    /// register RH_RF95_REG_1D_MODEM_CONFIG1 is invalid, returns 0.
+    virtual uint32_t timeOnAir(uint8_t len);
+
     /// brian.n.norman@gmail.com 9th Nov 2018
     /// Sets the radio spreading factor.
     /// valid values are 6 through 12.
@@ -843,6 +867,27 @@ public:
     /// \param[in] on bool, true enables CRCs in incoming and outgoing packets, false disables them
     void setPayloadCRC(bool on);
 
+    /// Selects the compact header format, which leaves out the header fields that carry nothing
+    /// for one-hop broadcasts. The HEADER becomes 2 octets (FROM, FLAGS) instead of 4:
+    /// TO is always RH_BROADCAST_ADDRESS and is not sent, and ID is not sent and is received as 0.
+    /// An application that needs a message id carries it in its own data, alongside whatever else
+    /// identifies the message. Only suits RHDatagram broadcasts: send() refuses any other TO address, so
+    /// RHReliableDatagram and the classes built on it, which address and acknowledge each message, can't be used.
+    /// Caution: this must be set the same on all nodes in your network. Default is false.
+    /// \param[in] compact true for the 2 octet header, false for the normal 4 octet header
+    void setCompactHeader(bool compact);
+
+    /// Selects LoRa implicit header mode for packets of one fixed length. The radio then sends no
+    /// explicit header (length, coding rate and CRC flag), saving about 20 bits of airtime per packet.
+    /// The receiver can't find the length in the packet, so every packet in the network must have the same
+    /// length: send() refuses any other length. Coding rate and CRC setting must match on all nodes too.
+    /// Stays in effect across setModemConfig() and setModemRegisters().
+    /// Caution: this must be set the same on all nodes in your network.
+    /// \param[in] len The length of every message passed to send(), not counting the RH_RF95 header.
+    /// 0 returns to explicit header mode, the default.
+    /// \return true if len fits in a message
+    bool setImplicitHeader(uint8_t len);
+
     /// tilman_1@gloetzner.net
     /// Returns device version from register 42
     /// \param none
@@ -866,6 +911,14 @@ protected:
     /// \param[in] mode RHMode the new mode about to take effect
     /// \return true if the subclasses changes successful
     virtual bool modeWillChange(RHMode) {return true;}
+
+    /// Returns whether a message of len octets can be sent with the current header modes and TO address.
+    /// Called by send() and sendReply().
+    bool           canSend(uint8_t len);
+
+    /// Writes the headers and data to the FIFO and starts the transmitter.
+    /// Called by send() and sendReply() with the radio idle.
+    void           startTransmit(const uint8_t* data, uint8_t len);
     
     /// False if the PA_BOOST transmitter output pin is to be used.
     /// True if the RFO transmitter output pin is to be used.
@@ -914,6 +967,12 @@ private:
 
     /// device ID
     uint8_t		_deviceVersion = 0x00;
+
+    /// Length of the RH_RF95 headers, RH_RF95_HEADER_LEN or RH_RF95_COMPACT_HEADER_LEN
+    uint8_t             _headerLen;
+
+    /// Message length in implicit header mode, 0 in explicit header mode
+    uint8_t             _implicitLen;
     
 };
 
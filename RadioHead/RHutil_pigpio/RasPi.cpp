@@ -15,6 +15,8 @@
 #if (RH_PLATFORM == RH_PLATFORM_RASPI)
 #include <sys/time.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
 #include "RasPi.h"
 #include <stdio.h>
 
@@ -166,18 +168,22 @@ unsigned long millis()
 
 void delay (unsigned long ms)
 {
-  //Implement Delay function
+  //Implement Delay function. ms is milliseconds, so split it into seconds and nanoseconds
   struct timespec ts;
-  ts.tv_sec=0;
-  ts.tv_nsec=(ms * 1000);
-  nanosleep(&ts,&ts);
+  ts.tv_sec=ms / 1000;
+  ts.tv_nsec=(ms % 1000) * 1000000;
+  //Sleep the rest of the time if a signal interrupts the sleep
+  while (nanosleep(&ts,&ts) == -1 && errno == EINTR)
+    ;
 }
 
 long random(long min, long max)
 {
+  //Like Arduino, return a number from min up to but not including max
   long diff = max - min;
-  long ret = diff * rand() + min;
-  return ret;
+  if (diff <= 0)
+    return min;
+  return min + rand() % diff;
 }
 
 //******************************
@@ -185,24 +191,82 @@ long random(long min, long max)
 //* Emulate Arduino Function
 //******************************
 
+//Handlers attached to each GPIO, run by isrDispatch on the pigpio ISR thread
+static void (*isrHandlers[32])(void);
+//Called after every handler, see attachInterruptHook()
+static void (*isrHook)(unsigned char pin);
+//Counts interrupts so yield() can tell when one has been handled
+static unsigned long isrCount;
+static pthread_mutex_t isrMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t isrCond = PTHREAD_COND_INITIALIZER;
+
+static void isrDispatch(int gpio, int level, uint32_t tick)
+{
+  (void)level;
+  (void)tick;
+  if (gpio < 0 || gpio >= 32 || !isrHandlers[gpio])
+    return;
+  isrHandlers[gpio]();
+
+  //Wake anything waiting in yield() now the driver has seen the interrupt
+  pthread_mutex_lock(&isrMutex);
+  isrCount++;
+  pthread_cond_broadcast(&isrCond);
+  pthread_mutex_unlock(&isrMutex);
+
+  if (isrHook)
+    isrHook(gpio);
+}
+
 void attachInterrupt(unsigned char pin, void (*handler)(void), int mode)
 {
+    if (pin >= 32)
+        return;
+    isrHandlers[pin] = handler;
     switch(mode)
     {
         case CHANGE:
-            gpioSetISRFunc(pin, EITHER_EDGE, 0, (void (*)(int,int,unsigned int))handler);
+            gpioSetISRFunc(pin, EITHER_EDGE, 0, isrDispatch);
             break;
         case RISING:
-            gpioSetISRFunc(pin, RISING_EDGE, 0, (void (*)(int,int,unsigned int))handler);
+            gpioSetISRFunc(pin, RISING_EDGE, 0, isrDispatch);
             break;
         case FALLING:
-            gpioSetISRFunc(pin, FALLING_EDGE, 0, (void (*)(int,int,unsigned int))handler);
+            gpioSetISRFunc(pin, FALLING_EDGE, 0, isrDispatch);
             break;
         default:
             break;
     }
 }
 
+void attachInterruptHook(void (*hook)(unsigned char pin))
+{
+  isrHook = hook;
+}
+
+//Sleeps until the next interrupt has been handled, or for at most 1 ms.
+//Used by YIELD so RadioHead's wait loops don't spin a core.
+void yield()
+{
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += 1000000;
+  if (until.tv_nsec >= 1000000000)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&isrMutex);
+  unsigned long seen = isrCount;
+  while (seen == isrCount)
+  {
+    if (pthread_cond_timedwait(&isrCond, &isrMutex, &until) != 0)
+      break;
+  }
+  pthread_mutex_unlock(&isrMutex);
+}
+
 void SerialSimulator::begin(int baud)
 {
   //No implementation neccesary - Serial emulation on Linux = standard console
@@ -159,6 +159,13 @@ long random(long min, long max);
 
 void attachInterrupt(unsigned char pin, void (*handler)(void), int mode);
 
+//Registers a function called on the pigpio ISR thread after the handler for any
+//attached interrupt has run. It must not block; writing to an eventfd or pipe is fine.
+void attachInterruptHook(void (*hook)(unsigned char pin));
+
+//Waits for the next interrupt or 1 ms, whichever is first. Used for YIELD.
+void yield();
+
 
 
 //The following lines are borrowed from bcm2835.h, which is part of the BCM2835 library
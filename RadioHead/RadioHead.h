@@ -1765,6 +1765,9 @@ these examples and explanations and extend them to suit your needs.
 #elif (RH_PLATFORM == RH_PLATFORM_ESP32)
  // ESP32 also has it
  #define YIELD yield();
+#elif (RH_PLATFORM == RH_PLATFORM_RASPI) && __has_include (<pigpio.h>)
+ // RHutil_pigpio sleeps until the next radio interrupt instead of spinning
+ #define YIELD yield();
 #else
  #define YIELD
 #endif
@@ -0,0 +1,204 @@
+/* "aes_ccm.cpp" implements AES-CCM as declared in aes_ccm.h.
+ * CBC-MAC over the formatted header, associated data and plaintext gives the tag,
+ * then counter mode encrypts the plaintext (blocks 1..n) and the tag (block 0).
+ */
+#include "aes_ccm.h"
+
+#include <string.h>
+
+// XORs len bytes of b into a
+static void xorBlock(uint8_t *a, const uint8_t *b, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    a[i] ^= b[i];
+  }
+}
+
+// Builds counter block A_i: flags, nonce, then the counter in the remaining L bytes
+static void counterBlock(uint8_t block[AES_BLOCK_SIZE], const uint8_t *nonce, size_t nonceLen, size_t counter)
+{
+  size_t L = 15 - nonceLen;
+
+  block[0] = (uint8_t)(L - 1);
+  memcpy(block + 1, nonce, nonceLen);
+  for (size_t i = 0; i < L; i++)
+  {
+    block[AES_BLOCK_SIZE - 1 - i] = (uint8_t)(counter >> (8 * i));
+  }
+}
+
+// CBC-MAC over B_0, the encoded associated data and the plaintext. Full tag left in tag.
+static void cbcMac(const AESKeySchedule *schedule, const uint8_t *nonce, size_t nonceLen,
+                   const uint8_t *aad, size_t aadLen, const uint8_t *plain, size_t len,
+                   size_t micLen, uint8_t tag[AES_BLOCK_SIZE])
+{
+  size_t L = 15 - nonceLen;
+  uint8_t block[AES_BLOCK_SIZE];
+
+  // B_0: flags, nonce, message length
+  block[0] = (uint8_t)((aadLen > 0 ? 0x40 : 0x00) | (((micLen - 2) / 2) << 3) | (L - 1));
+  memcpy(block + 1, nonce, nonceLen);
+  for (size_t i = 0; i < L; i++)
+  {
+    block[AES_BLOCK_SIZE - 1 - i] = (uint8_t)(len >> (8 * i));
+  }
+  AESFastEncrypt(schedule, block, tag);
+
+  // Associated data, prefixed by its 2 byte length and zero padded to a block
+  if (aadLen > 0)
+  {
+    size_t used = 2;
+    memset(block, 0, sizeof(block));
+    block[0] = (uint8_t)(aadLen >> 8);
+    block[1] = (uint8_t)aadLen;
+    for (size_t i = 0; i < aadLen; i++)
+    {
+      block[used++] = aad[i];
+      if (used == AES_BLOCK_SIZE)
+      {
+        xorBlock(tag, block, AES_BLOCK_SIZE);
+        AESFastEncrypt(schedule, tag, tag);
+        memset(block, 0, sizeof(block));
+        used = 0;
+      }
+    }
+    if (used > 0)
+    {
+      xorBlock(tag, block, AES_BLOCK_SIZE);
+      AESFastEncrypt(schedule, tag, tag);
+    }
+  }
+
+  // Plaintext, zero padded to a block
+  for (size_t offset = 0; offset < len; offset += AES_BLOCK_SIZE)
+  {
+    size_t n = len - offset < AES_BLOCK_SIZE ? len - offset : AES_BLOCK_SIZE;
+    xorBlock(tag, plain + offset, n);
+    AESFastEncrypt(schedule, tag, tag);
+  }
+}
+
+// Counter mode over len bytes starting at counter 1
+static void ctrCrypt(const AESKeySchedule *schedule, const uint8_t *nonce, size_t nonceLen,
+                     const uint8_t *in, size_t len, uint8_t *out)
+{
+  uint8_t block[AES_BLOCK_SIZE];
+  uint8_t keyStream[AES_BLOCK_SIZE];
+  size_t counter = 1;
+
+  for (size_t offset = 0; offset < len; offset += AES_BLOCK_SIZE)
+  {
+    size_t n = len - offset < AES_BLOCK_SIZE ? len - offset : AES_BLOCK_SIZE;
+    counterBlock(block, nonce, nonceLen, counter++);
+    AESFastEncrypt(schedule, block, keyStream);
+    for (size_t i = 0; i < n; i++)
+    {
+      out[offset + i] = in[offset + i] ^ keyStream[i];
+    }
+  }
+}
+
+// Encrypts the tag with counter block A_0
+static void encryptTag(const AESKeySchedule *schedule, const uint8_t *nonce, size_t nonceLen, uint8_t tag[AES_BLOCK_SIZE])
+{
+  uint8_t block[AES_BLOCK_SIZE];
+  uint8_t keyStream[AES_BLOCK_SIZE];
+
+  counterBlock(block, nonce, nonceLen, 0);
+  AESFastEncrypt(schedule, block, keyStream);
+  xorBlock(tag, keyStream, AES_BLOCK_SIZE);
+}
+
+static void ccmEncrypt(const AESKeySchedule *schedule, const uint8_t *nonce, size_t nonceLen,
+                       const uint8_t *aad, size_t aadLen, const uint8_t *plain, size_t len,
+                       uint8_t *cipher, uint8_t *mic, size_t micLen)
+{
+  uint8_t tag[AES_BLOCK_SIZE];
+
+  cbcMac(schedule, nonce, nonceLen, aad, aadLen, plain, len, micLen, tag);
+  encryptTag(schedule, nonce, nonceLen, tag);
+  ctrCrypt(schedule, nonce, nonceLen, plain, len, cipher);
+  memcpy(mic, tag, micLen);
+}
+
+static bool ccmDecrypt(const AESKeySchedule *schedule, const uint8_t *nonce, size_t nonceLen,
+                       const uint8_t *aad, size_t aadLen, const uint8_t *cipher, size_t len,
+                       const uint8_t *mic, size_t micLen, uint8_t *plain)
+{
+  uint8_t tag[AES_BLOCK_SIZE];
+  uint8_t diff = 0;
+
+  ctrCrypt(schedule, nonce, nonceLen, cipher, len, plain);
+  cbcMac(schedule, nonce, nonceLen, aad, aadLen, plain, len, micLen, tag);
+  encryptTag(schedule, nonce, nonceLen, tag);
+
+  // Compare without an early exit so the timing does not leak how many bytes matched
+  for (size_t i = 0; i < micLen; i++)
+  {
+    diff |= tag[i] ^ mic[i];
+  }
+  if (diff != 0)
+  {
+    memset(plain, 0, len);
+    return false;
+  }
+  return true;
+}
+
+void AESCCMEncrypt(const AESKeySchedule *schedule, const uint8_t nonce[AES_CCM_NONCE_LEN],
+                   const uint8_t *aad, size_t aadLen, const uint8_t *plain, size_t len,
+                   uint8_t *cipher, uint8_t mic[AES_CCM_MIC_LEN])
+{
+  ccmEncrypt(schedule, nonce, AES_CCM_NONCE_LEN, aad, aadLen, plain, len, cipher, mic, AES_CCM_MIC_LEN);
+}
+
+bool AESCCMDecrypt(const AESKeySchedule *schedule, const uint8_t nonce[AES_CCM_NONCE_LEN],
+                   const uint8_t *aad, size_t aadLen, const uint8_t *cipher, size_t len,
+                   const uint8_t mic[AES_CCM_MIC_LEN], uint8_t *plain)
+{
+  return ccmDecrypt(schedule, nonce, AES_CCM_NONCE_LEN, aad, aadLen, cipher, len, mic, AES_CCM_MIC_LEN, plain);
+}
+
+bool AESCCMSelfTest()
+{
+  AESKeySchedule schedule;
+  uint8_t cipher[32];
+  uint8_t plain[32];
+  uint8_t mic[8];
+  bool ok = true;
+
+  // NIST SP 800-38C appendix C, example 1: 7 byte nonce, 4 byte MIC
+  const uint8_t nistKey[16] = {0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f};
+  const uint8_t nistNonce[7] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16};
+  const uint8_t nistAad[8] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
+  const uint8_t nistPlain[4] = {0x20, 0x21, 0x22, 0x23};
+  const uint8_t nistOut[8] = {0x71, 0x62, 0x01, 0x5b, 0x4d, 0xac, 0x25, 0x5d};
+
+  AESFastExpandKey(nistKey, &schedule);
+  ccmEncrypt(&schedule, nistNonce, 7, nistAad, 8, nistPlain, 4, cipher, mic, 4);
+  ok = ok && memcmp(cipher, nistOut, 4) == 0 && memcmp(mic, nistOut + 4, 4) == 0;
+  ok = ok && ccmDecrypt(&schedule, nistNonce, 7, nistAad, 8, cipher, 4, mic, 4, plain);
+  ok = ok && memcmp(plain, nistPlain, 4) == 0;
+
+  // RFC 3610 packet vector 1: 13 byte nonce, 8 byte MIC
+  const uint8_t rfcKey[16] = {0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf};
+  const uint8_t rfcNonce[13] = {0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+  const uint8_t rfcOut[31] = {0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2, 0xf0, 0x66, 0xd0, 0xc2, 0xc0, 0xf9, 0x89, 0x80,
+                              0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3, 0x84, 0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0};
+  uint8_t rfcInput[31];
+  for (int i = 0; i < 31; i++)
+  {
+    rfcInput[i] = (uint8_t)i; // 8 bytes of associated data then 23 bytes of plaintext
+  }
+
+  AESFastExpandKey(rfcKey, &schedule);
+  ccmEncrypt(&schedule, rfcNonce, 13, rfcInput, 8, rfcInput + 8, 23, cipher, mic, 8);
+  ok = ok && memcmp(cipher, rfcOut, 23) == 0 && memcmp(mic, rfcOut + 23, 8) == 0;
+
+  // A modified frame must be rejected
+  cipher[0] ^= 0x01;
+  ok = ok && !ccmDecrypt(&schedule, rfcNonce, 13, rfcInput, 8, cipher, 23, mic, 8, plain);
+
+  return ok;
+}
@@ -0,0 +1,36 @@
+/* "aes_ccm.h" declares AES-CCM (RFC 3610, NIST SP 800-38C) authenticated encryption
+ * on top of the AES engine in aes_fast.h. A frame is encrypted in counter mode and
+ * carries a short MIC, so integrity is checked by the receiver instead of by echoing
+ * the ciphertext back to the sender.
+ */
+#ifndef AES_CCM_H
+#define AES_CCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aes_fast.h"
+
+// Nonce length. Leaves a 2 byte block counter, enough for 1 MB per nonce.
+#define AES_CCM_NONCE_LEN 13
+// Length of the MIC appended to every frame
+#define AES_CCM_MIC_LEN 4
+
+/* Encrypts len bytes of plain into cipher and computes a AES_CCM_MIC_LEN byte MIC over
+ * aad and plain. The nonce must never repeat under the same key.
+ */
+void AESCCMEncrypt(const AESKeySchedule *schedule, const uint8_t nonce[AES_CCM_NONCE_LEN],
+                   const uint8_t *aad, size_t aadLen, const uint8_t *plain, size_t len,
+                   uint8_t *cipher, uint8_t mic[AES_CCM_MIC_LEN]);
+
+/* Decrypts len bytes of cipher into plain and checks the MIC.
+ * Returns false and zeroes plain if the frame was modified or the key is wrong.
+ */
+bool AESCCMDecrypt(const AESKeySchedule *schedule, const uint8_t nonce[AES_CCM_NONCE_LEN],
+                   const uint8_t *aad, size_t aadLen, const uint8_t *cipher, size_t len,
+                   const uint8_t mic[AES_CCM_MIC_LEN], uint8_t *plain);
+
+// Runs the NIST SP 800-38C example 1 and RFC 3610 packet vector 1. Returns false on mismatch.
+bool AESCCMSelfTest();
+
+#endif /* AES_CCM_H */
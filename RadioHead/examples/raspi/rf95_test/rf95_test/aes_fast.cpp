@@ -0,0 +1,317 @@
+/* "aes_fast.cpp" implements the AES-128 engine declared in aes_fast.h.
+ * The T-tables fold SubBytes, ShiftRows and MixColumns into 4 lookups and 4 XORs per
+ * column, so a block takes 160 table reads instead of the byte-at-a-time steps used by
+ * the reference functions in rf95_test.cpp.
+ */
+#include "aes_fast.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define AES_FAST_HAVE_NI_PATH
+#endif
+
+// Lookup tables, built once by buildTables()
+static uint8_t sbox[256];
+static uint8_t invSbox[256];
+static uint32_t Te0[256], Te1[256], Te2[256], Te3[256];
+static uint32_t Td0[256], Td1[256], Td2[256], Td3[256];
+
+static AESEngine activeEngine = AES_ENGINE_TTABLE;
+
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | ((uint32_t)(p)[3]))
+#define PUTU32(p, v)               \
+  {                                \
+    (p)[0] = (uint8_t)((v) >> 24); \
+    (p)[1] = (uint8_t)((v) >> 16); \
+    (p)[2] = (uint8_t)((v) >> 8);  \
+    (p)[3] = (uint8_t)(v);         \
+  }
+
+static inline uint32_t rotr32(uint32_t v, int n)
+{
+  return (v >> n) | (v << (32 - n));
+}
+
+static inline uint8_t rotl8(uint8_t v, int n)
+{
+  return (uint8_t)((v << n) | (v >> (8 - n)));
+}
+
+// Multiply by x in GF(2^8)
+static inline uint8_t xtime(uint8_t v)
+{
+  return (uint8_t)((v << 1) ^ ((v & 0x80) ? 0x1b : 0x00));
+}
+
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+  uint8_t p = 0;
+  while (b)
+  {
+    if (b & 1)
+    {
+      p ^= a;
+    }
+    a = xtime(a);
+    b >>= 1;
+  }
+  return p;
+}
+
+/* Generates the S-box from the field inverse and the affine transform, then derives the
+ * encryption and decryption T-tables from it.
+ */
+static bool buildTables()
+{
+  uint8_t p = 1;
+  uint8_t q = 1;
+
+  // p walks every non-zero element by multiplying by 3, q tracks its inverse
+  do
+  {
+    p = p ^ xtime(p);
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    if (q & 0x80)
+    {
+      q ^= 0x09;
+    }
+    sbox[p] = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^ 0x63;
+  } while (p != 1);
+  sbox[0] = 0x63;
+
+  for (int i = 0; i < 256; i++)
+  {
+    invSbox[sbox[i]] = (uint8_t)i;
+  }
+
+  for (int i = 0; i < 256; i++)
+  {
+    uint8_t s = sbox[i];
+    uint32_t te = ((uint32_t)gmul(s, 2) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | gmul(s, 3);
+    Te0[i] = te;
+    Te1[i] = rotr32(te, 8);
+    Te2[i] = rotr32(te, 16);
+    Te3[i] = rotr32(te, 24);
+
+    uint8_t is = invSbox[i];
+    uint32_t td = ((uint32_t)gmul(is, 14) << 24) | ((uint32_t)gmul(is, 9) << 16) | ((uint32_t)gmul(is, 13) << 8) | gmul(is, 11);
+    Td0[i] = td;
+    Td1[i] = rotr32(td, 8);
+    Td2[i] = rotr32(td, 16);
+    Td3[i] = rotr32(td, 24);
+  }
+
+  if (AESFastHaveNI())
+  {
+    activeEngine = AES_ENGINE_AESNI;
+  }
+  return true;
+}
+
+static void ensureTables()
+{
+  static bool ready = buildTables();
+  (void)ready;
+}
+
+// T-table encryption of one block
+static void encryptTable(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+  const uint32_t *rk = schedule->encryptKeys;
+  uint32_t s0 = GETU32(in) ^ rk[0];
+  uint32_t s1 = GETU32(in + 4) ^ rk[1];
+  uint32_t s2 = GETU32(in + 8) ^ rk[2];
+  uint32_t s3 = GETU32(in + 12) ^ rk[3];
+  uint32_t t0, t1, t2, t3;
+
+  for (int round = 1; round < AES_ROUNDS; round++)
+  {
+    rk += 4;
+    t0 = Te0[s0 >> 24] ^ Te1[(s1 >> 16) & 0xff] ^ Te2[(s2 >> 8) & 0xff] ^ Te3[s3 & 0xff] ^ rk[0];
+    t1 = Te0[s1 >> 24] ^ Te1[(s2 >> 16) & 0xff] ^ Te2[(s3 >> 8) & 0xff] ^ Te3[s0 & 0xff] ^ rk[1];
+    t2 = Te0[s2 >> 24] ^ Te1[(s3 >> 16) & 0xff] ^ Te2[(s0 >> 8) & 0xff] ^ Te3[s1 & 0xff] ^ rk[2];
+    t3 = Te0[s3 >> 24] ^ Te1[(s0 >> 16) & 0xff] ^ Te2[(s1 >> 8) & 0xff] ^ Te3[s2 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  // Final round has no MixColumns
+  rk += 4;
+  t0 = ((uint32_t)sbox[s0 >> 24] << 24) ^ ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) ^ sbox[s3 & 0xff] ^ rk[0];
+  t1 = ((uint32_t)sbox[s1 >> 24] << 24) ^ ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) ^ sbox[s0 & 0xff] ^ rk[1];
+  t2 = ((uint32_t)sbox[s2 >> 24] << 24) ^ ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) ^ sbox[s1 & 0xff] ^ rk[2];
+  t3 = ((uint32_t)sbox[s3 >> 24] << 24) ^ ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) ^ sbox[s2 & 0xff] ^ rk[3];
+  PUTU32(out, t0);
+  PUTU32(out + 4, t1);
+  PUTU32(out + 8, t2);
+  PUTU32(out + 12, t3);
+}
+
+// T-table decryption of one block, using the equivalent inverse cipher
+static void decryptTable(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+  const uint32_t *rk = schedule->decryptKeys;
+  uint32_t s0 = GETU32(in) ^ rk[0];
+  uint32_t s1 = GETU32(in + 4) ^ rk[1];
+  uint32_t s2 = GETU32(in + 8) ^ rk[2];
+  uint32_t s3 = GETU32(in + 12) ^ rk[3];
+  uint32_t t0, t1, t2, t3;
+
+  for (int round = 1; round < AES_ROUNDS; round++)
+  {
+    rk += 4;
+    t0 = Td0[s0 >> 24] ^ Td1[(s3 >> 16) & 0xff] ^ Td2[(s2 >> 8) & 0xff] ^ Td3[s1 & 0xff] ^ rk[0];
+    t1 = Td0[s1 >> 24] ^ Td1[(s0 >> 16) & 0xff] ^ Td2[(s3 >> 8) & 0xff] ^ Td3[s2 & 0xff] ^ rk[1];
+    t2 = Td0[s2 >> 24] ^ Td1[(s1 >> 16) & 0xff] ^ Td2[(s0 >> 8) & 0xff] ^ Td3[s3 & 0xff] ^ rk[2];
+    t3 = Td0[s3 >> 24] ^ Td1[(s2 >> 16) & 0xff] ^ Td2[(s1 >> 8) & 0xff] ^ Td3[s0 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  // Final round has no InverseMixColumns
+  rk += 4;
+  t0 = ((uint32_t)invSbox[s0 >> 24] << 24) ^ ((uint32_t)invSbox[(s3 >> 16) & 0xff] << 16) ^ ((uint32_t)invSbox[(s2 >> 8) & 0xff] << 8) ^ invSbox[s1 & 0xff] ^ rk[0];
+  t1 = ((uint32_t)invSbox[s1 >> 24] << 24) ^ ((uint32_t)invSbox[(s0 >> 16) & 0xff] << 16) ^ ((uint32_t)invSbox[(s3 >> 8) & 0xff] << 8) ^ invSbox[s2 & 0xff] ^ rk[1];
+  t2 = ((uint32_t)invSbox[s2 >> 24] << 24) ^ ((uint32_t)invSbox[(s1 >> 16) & 0xff] << 16) ^ ((uint32_t)invSbox[(s0 >> 8) & 0xff] << 8) ^ invSbox[s3 & 0xff] ^ rk[2];
+  t3 = ((uint32_t)invSbox[s3 >> 24] << 24) ^ ((uint32_t)invSbox[(s2 >> 16) & 0xff] << 16) ^ ((uint32_t)invSbox[(s1 >> 8) & 0xff] << 8) ^ invSbox[s0 & 0xff] ^ rk[3];
+  PUTU32(out, t0);
+  PUTU32(out + 4, t1);
+  PUTU32(out + 8, t2);
+  PUTU32(out + 12, t3);
+}
+
+#ifdef AES_FAST_HAVE_NI_PATH
+// AES-NI encryption of one block. Only called after AESFastHaveNI() returned true.
+__attribute__((target("aes,sse2"))) static void encryptNI(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+  const __m128i *rk = (const __m128i *)schedule->encryptKeyBytes;
+  __m128i block = _mm_loadu_si128((const __m128i *)in);
+
+  block = _mm_xor_si128(block, _mm_load_si128(&rk[0]));
+  for (int round = 1; round < AES_ROUNDS; round++)
+  {
+    block = _mm_aesenc_si128(block, _mm_load_si128(&rk[round]));
+  }
+  block = _mm_aesenclast_si128(block, _mm_load_si128(&rk[AES_ROUNDS]));
+  _mm_storeu_si128((__m128i *)out, block);
+}
+
+// AES-NI decryption of one block. The decrypt keys already have InverseMixColumns applied.
+__attribute__((target("aes,sse2"))) static void decryptNI(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+  const __m128i *rk = (const __m128i *)schedule->decryptKeyBytes;
+  __m128i block = _mm_loadu_si128((const __m128i *)in);
+
+  block = _mm_xor_si128(block, _mm_load_si128(&rk[0]));
+  for (int round = 1; round < AES_ROUNDS; round++)
+  {
+    block = _mm_aesdec_si128(block, _mm_load_si128(&rk[round]));
+  }
+  block = _mm_aesdeclast_si128(block, _mm_load_si128(&rk[AES_ROUNDS]));
+  _mm_storeu_si128((__m128i *)out, block);
+}
+#endif
+
+bool AESFastHaveNI()
+{
+#ifdef AES_FAST_HAVE_NI_PATH
+  return __builtin_cpu_supports("aes");
+#else
+  return false;
+#endif
+}
+
+bool AESFastSetEngine(AESEngine engine)
+{
+  ensureTables();
+  if (engine == AES_ENGINE_AESNI && !AESFastHaveNI())
+  {
+    return false;
+  }
+  activeEngine = engine;
+  return true;
+}
+
+const char *AESFastEngineName()
+{
+  ensureTables();
+  return activeEngine == AES_ENGINE_AESNI ? "AES-NI" : "T-table";
+}
+
+void AESFastExpandKey(const unsigned char key[16], AESKeySchedule *schedule)
+{
+  ensureTables();
+
+  uint32_t *w = schedule->encryptKeys;
+  uint8_t rcon = 0x01;
+
+  for (int i = 0; i < 4; i++)
+  {
+    w[i] = GETU32(key + 4 * i);
+  }
+
+  for (int i = 4; i < 4 * (AES_ROUNDS + 1); i++)
+  {
+    uint32_t temp = w[i - 1];
+    if (i % 4 == 0)
+    {
+      // RotWord, SubWord and the round constant
+      temp = ((uint32_t)sbox[(temp >> 16) & 0xff] << 24) ^ ((uint32_t)sbox[(temp >> 8) & 0xff] << 16) ^ ((uint32_t)sbox[temp & 0xff] << 8) ^ sbox[temp >> 24] ^ ((uint32_t)rcon << 24);
+      rcon = xtime(rcon);
+    }
+    w[i] = w[i - 4] ^ temp;
+  }
+
+  // Decryption keys are the encryption keys in reverse order, with InverseMixColumns
+  // applied to all but the first and last round
+  uint32_t *dk = schedule->decryptKeys;
+  for (int round = 0; round <= AES_ROUNDS; round++)
+  {
+    const uint32_t *ek = w + 4 * (AES_ROUNDS - round);
+    for (int c = 0; c < 4; c++)
+    {
+      uint32_t v = ek[c];
+      if (round != 0 && round != AES_ROUNDS)
+      {
+        v = Td0[sbox[v >> 24]] ^ Td1[sbox[(v >> 16) & 0xff]] ^ Td2[sbox[(v >> 8) & 0xff]] ^ Td3[sbox[v & 0xff]];
+      }
+      dk[4 * round + c] = v;
+    }
+  }
+
+  for (int i = 0; i < 4 * (AES_ROUNDS + 1); i++)
+  {
+    PUTU32(schedule->encryptKeyBytes + 4 * i, w[i]);
+    PUTU32(schedule->decryptKeyBytes + 4 * i, dk[i]);
+  }
+}
+
+void AESFastEncrypt(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+#ifdef AES_FAST_HAVE_NI_PATH
+  if (activeEngine == AES_ENGINE_AESNI)
+  {
+    encryptNI(schedule, in, out);
+    return;
+  }
+#endif
+  encryptTable(schedule, in, out);
+}
+
+void AESFastDecrypt(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out)
+{
+#ifdef AES_FAST_HAVE_NI_PATH
+  if (activeEngine == AES_ENGINE_AESNI)
+  {
+    decryptNI(schedule, in, out);
+    return;
+  }
+#endif
+  decryptTable(schedule, in, out);
+}
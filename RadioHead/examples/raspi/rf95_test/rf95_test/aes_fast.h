@@ -0,0 +1,51 @@
+/* "aes_fast.h" declares the table driven AES-128 engine used for packet crypto.
+ * The key is expanded once into an AESKeySchedule and reused for every block.
+ * Rounds use 32-bit T-tables; on x86 hosts with AES-NI the hardware instructions
+ * are selected at runtime instead.
+ */
+#ifndef AES_FAST_H
+#define AES_FAST_H
+
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES_ROUNDS 10
+
+// Engines that can run the rounds
+enum AESEngine
+{
+  AES_ENGINE_TTABLE = 0,
+  AES_ENGINE_AESNI
+};
+
+/* Round keys for one AES-128 key.
+ * Expanded once with AESFastExpandKey() and shared by every encrypt and decrypt call.
+ */
+struct AESKeySchedule
+{
+  // Forward round keys as big-endian words, 4 per round
+  uint32_t encryptKeys[4 * (AES_ROUNDS + 1)];
+  // Equivalent inverse cipher round keys, in the order they are applied
+  uint32_t decryptKeys[4 * (AES_ROUNDS + 1)];
+  // Same keys in byte form for the AES-NI path
+  alignas(16) unsigned char encryptKeyBytes[AES_BLOCK_SIZE * (AES_ROUNDS + 1)];
+  alignas(16) unsigned char decryptKeyBytes[AES_BLOCK_SIZE * (AES_ROUNDS + 1)];
+};
+
+// Expands a 16 byte key into schedule. Builds the lookup tables on first use.
+void AESFastExpandKey(const unsigned char key[16], AESKeySchedule *schedule);
+
+// Encrypts/decrypts one 16 byte block with the active engine. in and out may overlap.
+void AESFastEncrypt(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out);
+void AESFastDecrypt(const AESKeySchedule *schedule, const unsigned char *in, unsigned char *out);
+
+// True if the CPU supports the AES-NI instructions
+bool AESFastHaveNI();
+
+// Selects the engine used by AESFastEncrypt/AESFastDecrypt. Returns false if it is not available.
+bool AESFastSetEngine(AESEngine engine);
+
+// Name of the active engine, for the startup banner
+const char *AESFastEngineName();
+
+#endif /* AES_FAST_H */
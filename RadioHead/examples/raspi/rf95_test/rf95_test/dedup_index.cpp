@@ -0,0 +1,202 @@
+/* "dedup_index.cpp" implements the duplicate reading index declared in dedup_index.h.
+ * Saved file layout: 4 byte magic, current generation, 2 byte key count, then both generations.
+ */
+#include "dedup_index.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEDUP_BLOOM_MAGIC "RFDB"
+#define DEDUP_BLOOM_BITS (DEDUP_BLOOM_BYTES * 8)
+
+// FNV-1a over the 5 key bytes
+static uint32_t keyHash(uint8_t source, uint32_t timeStamp)
+{
+  uint8_t key[5] = {source, (uint8_t)(timeStamp >> 24), (uint8_t)(timeStamp >> 16), (uint8_t)(timeStamp >> 8), (uint8_t)timeStamp};
+  uint32_t h = 2166136261u;
+
+  for (int i = 0; i < 5; i++)
+  {
+    h ^= key[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Second, independent hash for the Bloom filter: the murmur3 finaliser of the first
+static uint32_t mixHash(uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h | 1;
+}
+
+DedupIndex::DedupIndex()
+    : _current(0), _generationKeys(0), _dirty(false), _lastSave(0), _warmUntil(0)
+{
+  memset(_slots, 0, sizeof(_slots));
+  memset(_bloom, 0, sizeof(_bloom));
+}
+
+bool DedupIndex::open(const std::string &fileName, uint32_t now)
+{
+  FILE *file;
+  uint8_t header[7];
+  bool loaded = false;
+
+  _fileName = fileName;
+  _warmUntil = now + DEDUP_INDEX_LIFETIME;
+  _lastSave = now;
+  file = fopen(fileName.c_str(), "rb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  if (fread(header, sizeof(header), 1, file) == 1 && memcmp(header, DEDUP_BLOOM_MAGIC, 4) == 0 && header[4] < 2 &&
+      fread(_bloom, sizeof(_bloom), 1, file) == 1)
+  {
+    _current = header[4];
+    _generationKeys = ((uint16_t)header[5] << 8) | header[6];
+    loaded = true;
+  }
+  else
+  {
+    memset(_bloom, 0, sizeof(_bloom));
+  }
+  fclose(file);
+  return loaded;
+}
+
+bool DedupIndex::contains(uint8_t source, uint32_t timeStamp, uint32_t now)
+{
+  uint32_t h1 = keyHash(source, timeStamp);
+
+  for (int i = 0; i < DEDUP_INDEX_PROBES; i++)
+  {
+    Slot *slot = &_slots[(h1 + i) & (DEDUP_INDEX_SLOTS - 1)];
+
+    if (slot->used && now - slot->inserted >= DEDUP_INDEX_LIFETIME)
+    {
+      slot->used = false;
+    }
+    if (slot->used && slot->source == source && slot->timeStamp == timeStamp)
+    {
+      return true;
+    }
+  }
+
+  // Not in the table. Until the table has run for a full lifetime, keys seen before the restart
+  // are only in the filter. After that the table alone decides, so filter false positives can't drop new readings.
+  return (int32_t)(now - _warmUntil) < 0 && bloomContains(h1, mixHash(h1));
+}
+
+void DedupIndex::insert(uint8_t source, uint32_t timeStamp, uint32_t now)
+{
+  uint32_t h1 = keyHash(source, timeStamp);
+  Slot *freeSlot = NULL;
+  Slot *oldestSlot = NULL;
+
+  for (int i = 0; i < DEDUP_INDEX_PROBES && freeSlot == NULL; i++)
+  {
+    Slot *slot = &_slots[(h1 + i) & (DEDUP_INDEX_SLOTS - 1)];
+
+    if (!slot->used || now - slot->inserted >= DEDUP_INDEX_LIFETIME)
+    {
+      freeSlot = slot;
+    }
+    else if (oldestSlot == NULL || (int32_t)(slot->inserted - oldestSlot->inserted) < 0)
+    {
+      oldestSlot = slot;
+    }
+  }
+
+  // A full probe window gives up its oldest entry
+  Slot *slot = freeSlot != NULL ? freeSlot : oldestSlot;
+  slot->source = source;
+  slot->timeStamp = timeStamp;
+  slot->inserted = now;
+  slot->used = true;
+
+  bloomInsert(h1, mixHash(h1));
+}
+
+bool DedupIndex::bloomContains(uint32_t h1, uint32_t h2) const
+{
+  for (int g = 0; g < 2; g++)
+  {
+    bool all = true;
+    for (uint32_t i = 0; i < DEDUP_BLOOM_HASHES && all; i++)
+    {
+      uint32_t bit = (h1 + i * h2) % DEDUP_BLOOM_BITS;
+      all = (_bloom[g][bit >> 3] & (1 << (bit & 7))) != 0;
+    }
+    if (all)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DedupIndex::bloomInsert(uint32_t h1, uint32_t h2)
+{
+  // Start a new generation when the current one is full. Its keys are kept in the other until that is reused.
+  if (_generationKeys >= DEDUP_BLOOM_GENERATION_KEYS)
+  {
+    _current ^= 1;
+    memset(_bloom[_current], 0, DEDUP_BLOOM_BYTES);
+    _generationKeys = 0;
+  }
+  for (uint32_t i = 0; i < DEDUP_BLOOM_HASHES; i++)
+  {
+    uint32_t bit = (h1 + i * h2) % DEDUP_BLOOM_BITS;
+    _bloom[_current][bit >> 3] |= 1 << (bit & 7);
+  }
+  _generationKeys++;
+  _dirty = true;
+}
+
+void DedupIndex::poll(uint32_t now)
+{
+  if (_dirty && now - _lastSave >= DEDUP_BLOOM_SAVE_INTERVAL)
+  {
+    save();
+    _lastSave = now;
+  }
+}
+
+bool DedupIndex::save()
+{
+  uint8_t header[7];
+  std::string tempName = _fileName + ".tmp";
+  FILE *file;
+  bool ok;
+
+  if (_fileName.empty())
+  {
+    return false;
+  }
+
+  memcpy(header, DEDUP_BLOOM_MAGIC, 4);
+  header[4] = _current;
+  header[5] = _generationKeys >> 8;
+  header[6] = _generationKeys;
+
+  // Write a new file and rename it over the old one, so a crash never leaves half a filter
+  file = fopen(tempName.c_str(), "wb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  ok = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(_bloom, sizeof(_bloom), 1, file) == 1;
+  ok = fclose(file) == 0 && ok;
+  ok = ok && rename(tempName.c_str(), _fileName.c_str()) == 0;
+  if (ok)
+  {
+    _dirty = false;
+  }
+  return ok;
+}
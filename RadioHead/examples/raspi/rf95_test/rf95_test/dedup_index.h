@@ -0,0 +1,76 @@
+/* "dedup_index.h" declares the index that tells a new reading from a retry or rebroadcast.
+ * Keys are (source node, record timestamp). Recent keys live in a fixed open addressing
+ * table probed over a short window, so a lookup never touches the disk. Keys also go into
+ * a two generation Bloom filter that is saved to disk, so the index is warm after a restart.
+ */
+#ifndef DEDUP_INDEX_H
+#define DEDUP_INDEX_H
+
+#include <stdint.h>
+#include <string>
+
+// Table size, a power of two
+#define DEDUP_INDEX_SLOTS 1024
+// Slots looked at for one key
+#define DEDUP_INDEX_PROBES 8
+// Seconds a key stays in the table
+#define DEDUP_INDEX_LIFETIME 3600
+// Bytes in each Bloom filter generation
+#define DEDUP_BLOOM_BYTES 8192
+// Bits set per key
+#define DEDUP_BLOOM_HASHES 6
+// Keys added to a generation before the older one is cleared and reused
+#define DEDUP_BLOOM_GENERATION_KEYS 2048
+// Seconds between saves of a changed Bloom filter
+#define DEDUP_BLOOM_SAVE_INTERVAL 60
+
+class DedupIndex
+{
+public:
+  DedupIndex();
+
+  /* Loads the Bloom filter saved in fileName, and saves to it from then on.
+   * The filter is consulted for DEDUP_INDEX_LIFETIME seconds after now, until the table
+   * covers everything seen since the restart.
+   * A missing or damaged file leaves the filter empty. Returns true if it was loaded.
+   */
+  bool open(const std::string &fileName, uint32_t now);
+
+  /* Returns true if (source, timeStamp) was seen before.
+   * now is the time in seconds, used to age out table entries.
+   */
+  bool contains(uint8_t source, uint32_t timeStamp, uint32_t now);
+
+  // Records (source, timeStamp) as seen. Call it once the reading is safely queued for storage.
+  void insert(uint8_t source, uint32_t timeStamp, uint32_t now);
+
+  // Saves the Bloom filter if it changed and DEDUP_BLOOM_SAVE_INTERVAL has passed
+  void poll(uint32_t now);
+
+  // Writes the Bloom filter to the file given to open(). Returns false on error.
+  bool save();
+
+private:
+  struct Slot
+  {
+    uint32_t timeStamp;
+    uint32_t inserted;
+    uint8_t source;
+    bool used;
+  };
+
+  bool bloomContains(uint32_t h1, uint32_t h2) const;
+  void bloomInsert(uint32_t h1, uint32_t h2);
+
+  Slot _slots[DEDUP_INDEX_SLOTS];
+  // _bloom[_current] takes new keys, both generations are checked
+  uint8_t _bloom[2][DEDUP_BLOOM_BYTES];
+  uint8_t _current;
+  uint16_t _generationKeys;
+  bool _dirty;
+  uint32_t _lastSave;
+  uint32_t _warmUntil;
+  std::string _fileName;
+};
+
+#endif /* DEDUP_INDEX_H */
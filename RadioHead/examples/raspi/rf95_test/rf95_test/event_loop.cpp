@@ -0,0 +1,163 @@
+/* "event_loop.cpp" implements the epoll loop declared in event_loop.h.
+ * Every fd is registered with its event bit as the epoll user data.
+ */
+#include "event_loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop()
+    : _epoll(-1), _radioEvent(-1), _stopEvent(-1)
+{
+  for (int i = 0; i < LOOP_TIMER_COUNT; i++)
+  {
+    _timers[i] = -1;
+  }
+}
+
+EventLoop::~EventLoop()
+{
+  for (int i = 0; i < LOOP_TIMER_COUNT; i++)
+  {
+    if (_timers[i] >= 0)
+    {
+      close(_timers[i]);
+    }
+  }
+  if (_radioEvent >= 0)
+  {
+    close(_radioEvent);
+  }
+  if (_stopEvent >= 0)
+  {
+    close(_stopEvent);
+  }
+  if (_epoll >= 0)
+  {
+    close(_epoll);
+  }
+}
+
+// Adds fd to the epoll set, reporting bit when it is readable
+static bool watch(int epoll, int fd, uint32_t bit)
+{
+  struct epoll_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = bit;
+  return fd >= 0 && epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool EventLoop::init()
+{
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  _radioEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _stopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_epoll < 0 || !watch(_epoll, _radioEvent, LOOP_EVENT_RADIO) || !watch(_epoll, _stopEvent, LOOP_EVENT_STOP))
+  {
+    printf("Event loop: %s\n", strerror(errno));
+    return false;
+  }
+
+  for (int i = 0; i < LOOP_TIMER_COUNT; i++)
+  {
+    _timers[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (!watch(_epoll, _timers[i], LOOP_TIMER_EVENT(i)))
+    {
+      printf("Event loop timer: %s\n", strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+void EventLoop::arm(LoopTimer timer, unsigned long ms)
+{
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = ms / 1000;
+  spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+  if (ms == 0)
+  {
+    // A zero it_value would disarm the timer, so fire as soon as possible instead
+    spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(_timers[timer], 0, &spec, NULL);
+  // Forget an expiry of the previous deadline that wait() has not seen yet
+  drain(_timers[timer]);
+}
+
+void EventLoop::disarm(LoopTimer timer)
+{
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  timerfd_settime(_timers[timer], 0, &spec, NULL);
+  drain(_timers[timer]);
+}
+
+void EventLoop::notifyRadio()
+{
+  uint64_t one = 1;
+  ssize_t unused = write(_radioEvent, &one, sizeof(one));
+  (void)unused;
+}
+
+void EventLoop::notifyStop()
+{
+  uint64_t one = 1;
+  ssize_t unused = write(_stopEvent, &one, sizeof(one));
+  (void)unused;
+}
+
+// Reads a timerfd or eventfd so it stops being readable
+void EventLoop::drain(int fd)
+{
+  uint64_t count;
+  ssize_t unused = read(fd, &count, sizeof(count));
+  (void)unused;
+}
+
+uint32_t EventLoop::wait(int timeoutMs)
+{
+  struct epoll_event events[LOOP_TIMER_COUNT + 2];
+  uint32_t fired = 0;
+  int n;
+
+  do
+  {
+    n = epoll_wait(_epoll, events, LOOP_TIMER_COUNT + 2, timeoutMs);
+  } while (n < 0 && errno == EINTR && timeoutMs < 0);
+
+  for (int i = 0; i < n; i++)
+  {
+    uint32_t bit = events[i].data.u32;
+    fired |= bit;
+    if (bit == LOOP_EVENT_RADIO)
+    {
+      drain(_radioEvent);
+    }
+    else if (bit == LOOP_EVENT_STOP)
+    {
+      drain(_stopEvent);
+    }
+    else
+    {
+      for (int t = 0; t < LOOP_TIMER_COUNT; t++)
+      {
+        if (bit == LOOP_TIMER_EVENT(t))
+        {
+          drain(_timers[t]);
+        }
+      }
+    }
+  }
+  return fired;
+}
@@ -0,0 +1,59 @@
+/* "event_loop.h" declares the epoll loop the node sleeps in between radio events.
+ * Each state machine timer is a timerfd, the DIO0 interrupt and Ctrl-C each write an
+ * eventfd, and wait() blocks until one of them fires instead of spinning on millis().
+ */
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+
+// Timers the state machine waits on
+enum LoopTimer
+{
+  TIMER_SLOT = 0,     // next slot action of this node
+  TIMER_JOIN_LISTEN,  // no beacon heard, create the network
+  TIMER_HOUSEKEEPING, // periodic reports and saves
+  LOOP_TIMER_COUNT
+};
+
+// Event bits returned by EventLoop::wait()
+#define LOOP_TIMER_EVENT(timer) (1u << (timer))
+#define LOOP_EVENT_RADIO (1u << LOOP_TIMER_COUNT)
+#define LOOP_EVENT_STOP (1u << (LOOP_TIMER_COUNT + 1))
+
+class EventLoop
+{
+public:
+  EventLoop();
+  ~EventLoop();
+
+  // Creates the epoll set, timers and eventfds. Returns false on error.
+  bool init();
+
+  // Starts timer as a one shot that fires ms from now, replacing any earlier deadline
+  void arm(LoopTimer timer, unsigned long ms);
+
+  // Stops timer
+  void disarm(LoopTimer timer);
+
+  // Wakes wait() with LOOP_EVENT_RADIO. Safe from the ISR thread.
+  void notifyRadio();
+
+  // Wakes wait() with LOOP_EVENT_STOP. Safe from a signal handler.
+  void notifyStop();
+
+  /* Blocks until an event fires or timeoutMs passes (-1 waits forever).
+   * Returns the event bits that fired, 0 on timeout.
+   */
+  uint32_t wait(int timeoutMs);
+
+private:
+  static void drain(int fd);
+
+  int _epoll;
+  int _radioEvent;
+  int _stopEvent;
+  int _timers[LOOP_TIMER_COUNT];
+};
+
+#endif /* EVENT_LOOP_H */
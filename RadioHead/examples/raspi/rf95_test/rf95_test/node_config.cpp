@@ -0,0 +1,106 @@
+/* "node_config.cpp" implements the config file reader declared in node_config.h.
+ */
+#include "node_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+// Strips leading and trailing blanks
+static std::string trim(const std::string &s)
+{
+  size_t begin = s.find_first_not_of(" \t\r");
+  size_t end = s.find_last_not_of(" \t\r");
+  return begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+}
+
+// Parses a node address. Returns 0 if text is not a number in 1..254.
+static uint8_t parseAddress(const std::string &text)
+{
+  char *end;
+  long value = strtol(text.c_str(), &end, 10);
+  if (text.empty() || *end != '\0' || value < ROSTER_MIN_ADDRESS || value > ROSTER_MAX_ADDRESS)
+  {
+    return 0;
+  }
+  return (uint8_t)value;
+}
+
+bool NodeConfigLoad(const char *fileName, NodeConfig *config)
+{
+  std::ifstream file(fileName);
+  std::string line;
+  int lineNumber = 0;
+
+  config->address = 0;
+  config->dataPath.clear();
+  config->nodes.clear();
+  if (!file)
+  {
+    printf("Config %s could not be opened\n", fileName);
+    return false;
+  }
+
+  while (std::getline(file, line))
+  {
+    lineNumber++;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+    {
+      continue;
+    }
+
+    size_t equals = line.find('=');
+    std::string key = equals == std::string::npos ? line : trim(line.substr(0, equals));
+    std::string value = equals == std::string::npos ? std::string() : trim(line.substr(equals + 1));
+    bool ok = equals != std::string::npos;
+
+    if (ok && key == "address")
+    {
+      config->address = parseAddress(value);
+      ok = config->address != 0;
+    }
+    else if (ok && key == "data_path")
+    {
+      config->dataPath = value;
+      if (!value.empty() && value[value.size() - 1] != '/')
+      {
+        config->dataPath += '/';
+      }
+    }
+    else if (ok && key == "nodes")
+    {
+      // Addresses separated by blanks or commas
+      for (size_t i = 0; i < value.size(); i++)
+      {
+        value[i] = value[i] == ',' ? ' ' : value[i];
+      }
+      std::istringstream list(value);
+      std::string item;
+      while (ok && list >> item)
+      {
+        uint8_t address = parseAddress(item);
+        ok = address != 0;
+        config->nodes.add(address);
+      }
+    }
+    else
+    {
+      ok = false;
+    }
+
+    if (!ok)
+    {
+      printf("Config %s line %d not understood: %s\n", fileName, lineNumber, line.c_str());
+      return false;
+    }
+  }
+
+  if (config->address == 0)
+  {
+    printf("Config %s has no address\n", fileName);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+/* "node_config.h" declares the per-node settings read at startup, so the same binary runs on every node.
+ * The file holds "key = value" lines, blank lines and # comments:
+ *
+ *   address = 33
+ *   data_path = /media/node3/node3ssd/Node Data/
+ *   nodes = 11 22 33 44 55 66
+ *
+ * address is required. nodes lists the addresses allowed to join; without it any address may.
+ */
+#ifndef NODE_CONFIG_H
+#define NODE_CONFIG_H
+
+#include <stdint.h>
+#include <string>
+#include "roster.h"
+
+// Config file read when none is given on the command line
+#define NODE_CONFIG_FILE "rf95_test.conf"
+
+struct NodeConfig
+{
+  uint8_t address;      // this node's address, 1..254
+  std::string dataPath; // directory for the record store, ending in /
+  Roster nodes;         // addresses allowed to join, empty for any
+};
+
+/* Reads fileName into config. Prints the first bad line and returns false on error,
+ * or if the file can't be read or has no address.
+ */
+bool NodeConfigLoad(const char *fileName, NodeConfig *config);
+
+#endif /* NODE_CONFIG_H */
@@ -0,0 +1,66 @@
+/* "record_export.cpp" prints the readings kept by RecordStore as CSV, one row per record.
+ * Usage: record_export [directory] > readings.csv
+ * The directory defaults to the one rf95_test writes to. Segments are read oldest first.
+ */
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "record_store.h"
+
+int main(int argc, const char *argv[])
+{
+  std::string directory = argc > 1 ? argv[1] : "/media/node3/node3ssd/Node Data/";
+  if (directory.empty() || directory[directory.size() - 1] != '/')
+  {
+    directory += '/';
+  }
+
+  std::vector<uint32_t> segments = RecordStore::listSegments(directory);
+  if (segments.empty())
+  {
+    fprintf(stderr, "No segments found in %s\n", directory.c_str());
+    return 1;
+  }
+
+  printf("Source node,Time stamp,Phase angle (degrees),Phase on each bus (kW),Power flow on each transmission line (MW),Substation load (kW),Substation component status (boolean)\n");
+
+  for (size_t i = 0; i < segments.size(); i++)
+  {
+    std::string name = directory + RecordStore::segmentName(segments[i]);
+    FILE *file = fopen(name.c_str(), "rb");
+    uint8_t in[RECORD_STORE_RECORD_SIZE];
+    StoredRecord record;
+    unsigned long bad = 0;
+
+    if (file == NULL)
+    {
+      perror(name.c_str());
+      continue;
+    }
+    while (fread(in, sizeof(in), 1, file) == 1)
+    {
+      if (!RecordStore::decode(in, &record))
+      {
+        bad++;
+        continue;
+      }
+
+      time_t t = record.reading.timeStamp;
+      struct tm timeStruct = *localtime(&t);
+      char timeStamp[20];
+      strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%d %H:%M:%S", &timeStruct);
+
+      printf("%u,%s,%u,%u,%u,%u,%d\n", record.source, timeStamp, record.reading.phaseAngle, record.reading.busPhase,
+             record.reading.powerFlow, record.reading.load, record.reading.status);
+    }
+    fclose(file);
+
+    if (bad > 0)
+    {
+      fprintf(stderr, "%s: skipped %lu unreadable records\n", name.c_str(), bad);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,280 @@
+/* "record_store.cpp" implements the segmented record storage declared in record_store.h.
+ * Stored record layout: [0] version, [1] source node, [2] component status, [3] unused,
+ * [4..7] timestamp, then phase angle, bus phase, power flow and load as 16 bit values.
+ * All multi byte values are big endian.
+ */
+#include "record_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+// Segment files are named SEGMENT_PREFIX + 8 digit index + SEGMENT_SUFFIX
+#define SEGMENT_PREFIX "segment-"
+#define SEGMENT_SUFFIX ".dat"
+
+static void put16(uint8_t *p, uint16_t value)
+{
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return ((uint16_t)p[0] << 8) | p[1];
+}
+
+RecordStore::RecordStore()
+    : _fd(-1), _segment(0), _segmentRecords(0), _batchRecords(0), _unsynced(false), _batchStart(0), _lastSync(0)
+{
+}
+
+RecordStore::~RecordStore()
+{
+  close();
+}
+
+void RecordStore::encode(const StoredRecord &record, uint8_t out[RECORD_STORE_RECORD_SIZE])
+{
+  out[0] = RECORD_STORE_VERSION;
+  out[1] = record.source;
+  out[2] = record.reading.status ? 1 : 0;
+  out[3] = 0;
+  out[4] = record.reading.timeStamp >> 24;
+  out[5] = record.reading.timeStamp >> 16;
+  out[6] = record.reading.timeStamp >> 8;
+  out[7] = record.reading.timeStamp;
+  put16(out + 8, record.reading.phaseAngle);
+  put16(out + 10, record.reading.busPhase);
+  put16(out + 12, record.reading.powerFlow);
+  put16(out + 14, record.reading.load);
+}
+
+bool RecordStore::decode(const uint8_t in[RECORD_STORE_RECORD_SIZE], StoredRecord *record)
+{
+  if (in[0] != RECORD_STORE_VERSION)
+  {
+    return false;
+  }
+  record->source = in[1];
+  record->reading.status = in[2] != 0;
+  record->reading.timeStamp = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) | ((uint32_t)in[6] << 8) | in[7];
+  record->reading.phaseAngle = get16(in + 8);
+  record->reading.busPhase = get16(in + 10);
+  record->reading.powerFlow = get16(in + 12);
+  record->reading.load = get16(in + 14);
+  return true;
+}
+
+std::string RecordStore::segmentName(uint32_t index)
+{
+  char name[32];
+  snprintf(name, sizeof(name), SEGMENT_PREFIX "%08u" SEGMENT_SUFFIX, index);
+  return std::string(name);
+}
+
+std::vector<uint32_t> RecordStore::listSegments(const std::string &directory)
+{
+  std::vector<uint32_t> segments;
+  DIR *dir = opendir(directory.c_str());
+  struct dirent *entry;
+  unsigned int index;
+  char suffix[8];
+
+  if (dir == NULL)
+  {
+    return segments;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (sscanf(entry->d_name, SEGMENT_PREFIX "%8u%7s", &index, suffix) == 2 && strcmp(suffix, SEGMENT_SUFFIX) == 0)
+    {
+      segments.push_back(index);
+    }
+  }
+  closedir(dir);
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+bool RecordStore::open(const std::string &directory)
+{
+  close();
+  _directory = directory;
+
+  std::vector<uint32_t> segments = listSegments(directory);
+  return openSegment(segments.empty() ? 1 : segments.back());
+}
+
+/* Opens segment index for appending. A full segment moves on to the next index, and a
+ record torn by a crash at the end of the segment is cut off. */
+bool RecordStore::openSegment(uint32_t index)
+{
+  struct stat st;
+  std::string name;
+
+  for (;;)
+  {
+    name = segmentName(index);
+    if (stat((_directory + name).c_str(), &st) != 0)
+    {
+      st.st_size = 0;
+      logSegment(name);
+    }
+    if (st.st_size / RECORD_STORE_RECORD_SIZE < RECORD_STORE_SEGMENT_RECORDS)
+    {
+      break;
+    }
+    index++;
+  }
+
+  _fd = ::open((_directory + name).c_str(), O_WRONLY | O_CREAT, 0644);
+  if (_fd < 0)
+  {
+    printf("Record store: can't open %s%s: %s\n", _directory.c_str(), name.c_str(), strerror(errno));
+    return false;
+  }
+
+  off_t whole = (st.st_size / RECORD_STORE_RECORD_SIZE) * RECORD_STORE_RECORD_SIZE;
+  if (whole != st.st_size && ftruncate(_fd, whole) != 0)
+  {
+    printf("Record store: can't trim %s: %s\n", name.c_str(), strerror(errno));
+  }
+  lseek(_fd, whole, SEEK_SET);
+
+  _segment = index;
+  _segmentRecords = whole / RECORD_STORE_RECORD_SIZE;
+  return true;
+}
+
+// Adds a line to "Node Data.log" when a segment is created, so the log still names every data file
+void RecordStore::logSegment(const std::string &name)
+{
+  time_t now = time(0);
+  struct tm timeStruct = *localtime(&now);
+  char timeStamp[20];
+  std::ofstream file;
+
+  strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%d %H:%M:%S", &timeStruct);
+  file.open(_directory + "Node Data.log", std::ofstream::app);
+  if (file.is_open())
+  {
+    file << "[" << timeStamp << "] Segment created:[" << name << "] File directory path:[" << _directory + name << "]\n";
+    file.close();
+  }
+}
+
+bool RecordStore::append(const StoredRecord &record, unsigned long now)
+{
+  // A batch left full by a failed write must go out before anything else is queued
+  if (_batchRecords == RECORD_STORE_BATCH_RECORDS && !flush())
+  {
+    return false;
+  }
+  if (_batchRecords == 0)
+  {
+    _batchStart = now;
+  }
+  encode(record, _batch + _batchRecords * RECORD_STORE_RECORD_SIZE);
+  _batchRecords++;
+
+  if (_batchRecords == RECORD_STORE_BATCH_RECORDS)
+  {
+    return flush();
+  }
+  return true;
+}
+
+void RecordStore::poll(unsigned long now)
+{
+  if (_batchRecords > 0 && now - _batchStart >= RECORD_STORE_FLUSH_INTERVAL)
+  {
+    flush();
+  }
+  if (_unsynced && now - _lastSync >= RECORD_STORE_SYNC_INTERVAL)
+  {
+    sync();
+    _lastSync = now;
+  }
+}
+
+bool RecordStore::flush()
+{
+  uint16_t written = 0;
+
+  if (_fd < 0)
+  {
+    return false;
+  }
+
+  while (written < _batchRecords)
+  {
+    // Never let a write run past the end of the segment
+    uint32_t room = RECORD_STORE_SEGMENT_RECORDS - _segmentRecords;
+    uint16_t remaining = _batchRecords - written;
+    uint16_t count = remaining < room ? remaining : room;
+    size_t bytes = count * RECORD_STORE_RECORD_SIZE;
+
+    if (write(_fd, _batch + written * RECORD_STORE_RECORD_SIZE, bytes) != (ssize_t)bytes)
+    {
+      printf("Record store: write to %s failed: %s\n", segmentName(_segment).c_str(), strerror(errno));
+      // Cut off a partial write and keep what was not written so the next flush retries it
+      off_t end = (off_t)_segmentRecords * RECORD_STORE_RECORD_SIZE;
+      if (ftruncate(_fd, end) != 0 || lseek(_fd, end, SEEK_SET) != end)
+      {
+        printf("Record store: can't trim %s: %s\n", segmentName(_segment).c_str(), strerror(errno));
+      }
+      memmove(_batch, _batch + written * RECORD_STORE_RECORD_SIZE, (_batchRecords - written) * RECORD_STORE_RECORD_SIZE);
+      _batchRecords -= written;
+      return false;
+    }
+    written += count;
+    _segmentRecords += count;
+    _unsynced = true;
+
+    if (_segmentRecords == RECORD_STORE_SEGMENT_RECORDS)
+    {
+      fsync(_fd);
+      ::close(_fd);
+      _fd = -1;
+      _unsynced = false;
+      if (!openSegment(_segment + 1))
+      {
+        memmove(_batch, _batch + written * RECORD_STORE_RECORD_SIZE, (_batchRecords - written) * RECORD_STORE_RECORD_SIZE);
+        _batchRecords -= written;
+        return false;
+      }
+    }
+  }
+  _batchRecords = 0;
+  return true;
+}
+
+bool RecordStore::sync()
+{
+  bool ok = flush();
+
+  if (_fd >= 0 && _unsynced)
+  {
+    ok = fsync(_fd) == 0 && ok;
+    _unsynced = false;
+  }
+  return ok;
+}
+
+void RecordStore::close()
+{
+  if (_fd >= 0)
+  {
+    sync();
+    ::close(_fd);
+    _fd = -1;
+  }
+}
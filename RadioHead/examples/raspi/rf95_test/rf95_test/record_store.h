@@ -0,0 +1,91 @@
+/* "record_store.h" declares the append-only storage for received readings.
+ * Every reading becomes a fixed size binary record appended to a rolling segment file.
+ * Records are batched in memory, written with one write() per batch and synced to the
+ * SSD on a timer, so the directory only grows by one file per segment.
+ * record_export turns the segments back into CSV.
+ */
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "telemetry.h"
+
+// Version byte at the start of every stored record
+#define RECORD_STORE_VERSION 1
+// Size of one stored record on disk
+#define RECORD_STORE_RECORD_SIZE 16
+// Records per segment file, 1 MB per segment
+#define RECORD_STORE_SEGMENT_RECORDS 65536
+// Records held in memory before they are written
+#define RECORD_STORE_BATCH_RECORDS 32
+// A partly filled batch is written after this many ms
+#define RECORD_STORE_FLUSH_INTERVAL 5000
+// Written records are synced to the disk after this many ms
+#define RECORD_STORE_SYNC_INTERVAL 30000
+
+// One reading as kept on disk, with the node that produced it
+struct StoredRecord
+{
+  uint8_t source;
+  TelemetryRecord reading;
+};
+
+class RecordStore
+{
+public:
+  RecordStore();
+  // Writes and syncs anything still batched
+  ~RecordStore();
+
+  /* Opens the store in directory, which must end in '/'. Appends to the newest
+   * segment if it has room, otherwise starts a new one. Returns false on error.
+   */
+  bool open(const std::string &directory);
+
+  /* Queues one record. The batch is written when it is full, otherwise by poll().
+   * now is the caller's ms clock. Returns false if the batch could not be written;
+   * if the batch is full and still can't be written the record is dropped.
+   */
+  bool append(const StoredRecord &record, unsigned long now);
+
+  // Writes a stale batch and syncs written data when their intervals have passed
+  void poll(unsigned long now);
+
+  // Writes the batch to the current segment, rolling over to a new segment when it fills
+  bool flush();
+
+  // Writes the batch and fsyncs the current segment
+  bool sync();
+
+  // Syncs and closes the current segment
+  void close();
+
+  // Encodes/decodes one record in its on disk form. decode() rejects unknown versions.
+  static void encode(const StoredRecord &record, uint8_t out[RECORD_STORE_RECORD_SIZE]);
+  static bool decode(const uint8_t in[RECORD_STORE_RECORD_SIZE], StoredRecord *record);
+
+  // File name of segment index
+  static std::string segmentName(uint32_t index);
+
+  // Indexes of the segments in directory, oldest first
+  static std::vector<uint32_t> listSegments(const std::string &directory);
+
+private:
+  bool openSegment(uint32_t index);
+  void logSegment(const std::string &name);
+
+  std::string _directory;
+  int _fd;
+  uint32_t _segment;
+  uint32_t _segmentRecords;
+  uint8_t _batch[RECORD_STORE_BATCH_RECORDS * RECORD_STORE_RECORD_SIZE];
+  uint16_t _batchRecords;
+  bool _unsynced;
+  unsigned long _batchStart;
+  unsigned long _lastSync;
+};
+
+#endif /* RECORD_STORE_H */
@@ -2,7 +2,6 @@
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
-#include <map>
 #include <iostream>
 #include <fstream>
 #include <array>
@@ -11,9 +10,20 @@
 #include <cstring>
 #include <sstream>
 #include "structures.h"
+#include "aes_fast.h"
+#include "aes_ccm.h"
+#include "telemetry.h"
+#include "record_store.h"
+#include "dedup_index.h"
+#include "storage_writer.h"
+#include "event_loop.h"
+#include "tdma.h"
+#include "roster.h"
+#include "node_config.h"
 
 // Function Definitions
 void sig_handler(int sig);
+void radio_interrupt(unsigned char pin);
 
 // Driver for module used
 #include <RH_RF95.h>
@@ -24,21 +34,41 @@ void sig_handler(int sig);
 // Max message length
 #define RH_MESH_MAX_MESSAGE_LEN 50
 
-// Flag for join request message
-#define RH_FLAGS_JOIN_REQUEST 0x1f
+/* Frame kinds, sent as the header flags. They stay inside RH_FLAGS_APPLICATION_SPECIFIC,
+ the upper flag bits belong to RadioHead. */
+// Data frame sent by its source, acknowledged by the source's successor
+#define FRAME_KIND_DATA 0x01
+// Data frame relayed by a node other than its source. Relayed frames are not acknowledged.
+#define FRAME_KIND_RELAY 0x02
+// Acknowledgement of a data frame
+#define FRAME_KIND_ACK 0x03
+// Join request message
+#define FRAME_KIND_JOIN_REQUEST 0x04
+// The coordinator's beacon at the start of each cycle
+#define FRAME_KIND_BEACON 0x05
+
+/* Every frame is a one-hop broadcast sent with the RH_RF95 compact header, which carries only the sender
+ and the flags. The flag that says what kind of frame it is goes in the header, not in the frame. */
+
+/* Data frame layout: [0] source node, [1..4] sequence number,
+ then the AES-CCM ciphertext followed by AES_CCM_MIC_LEN bytes of MIC */
+#define FRAME_SOURCE 0
+#define FRAME_SEQUENCE 1
+#define FRAME_PAYLOAD 5
+#define FRAME_OVERHEAD (FRAME_PAYLOAD + AES_CCM_MIC_LEN)
+
+// Acknowledgement frame: [0] source of the acknowledged frame, [1..4] its sequence number
+#define ACK_FRAME_LEN 5
+
+// Join request frame: empty, the header names the node asking to join
+#define JOIN_FRAME_LEN 0
 
 // Pins used
 #define RFM95_CS_PIN 8
 #define RFM95_IRQ_PIN 4
 
-// Network of 6 nodes
-std::map<int, bool> node_status_map;
-#define NODE1_ADDRESS 11
-#define NODE2_ADDRESS 22
-#define THIS_NODE_ADDRESS 33
-#define NODE4_ADDRESS 44
-#define NODE5_ADDRESS 55
-#define NODE6_ADDRESS 66
+// This node's address, the nodes allowed to join and the data path, read at startup
+NodeConfig config;
 
 // RFM95 Configuration
 #define RFM95_FREQUENCY 915.00
@@ -47,20 +77,57 @@ std::map<int, bool> node_status_map;
 // Singleton instance of the radio driver
 RH_RF95 rf95(RFM95_CS_PIN, RFM95_IRQ_PIN);
 
-RHMesh manager(rf95, THIS_NODE_ADDRESS);
+// Address is set from the config before manager.init()
+RHMesh manager(rf95);
 
 // Flag for Ctrl-C to end the program.
 int flag = 0;
 
-// File writer global variables
-std::string path = "/media/node3/node3ssd/Node Data/";
-std::string fileName = "";
+// Radio interrupts, timers and Ctrl-C wake the main loop through this
+EventLoop eventLoop;
+
+// Longest the main loop sleeps without an event, in case a deadline is missed by a ms
+#define LOOP_MAX_SLEEP 1000
+
+// Storage global variables
 std::string packetTimeStamp = "packetTimeStamp";
 std::string logTimeStamp = "logFileTimeStamp";
-bool file_exists = false;
+
+// Segmented binary storage for every reading this node keeps. Export it with record_export.
+RecordStore store;
+
+// Thread that owns store. The radio loop only queues readings to it.
+StorageWriter storageWriter;
+
+// ms between storage queue reports
+#define STORAGE_REPORT_INTERVAL 60000
+
+// Readings already stored, keyed by source node and timestamp, so retries and rebroadcasts are stored once
+DedupIndex dedup;
+
+// Data frame sequence numbers reserved on disk at a time, see saveSequenceReserve()
+#define SEQUENCE_RESERVE 1024
+
+// Node states
+#define STATE_JOIN 1   // Not a member: listen for a beacon, then ask to join in the join slot
+#define STATE_MEMBER 2 // Member: transmit in this node's own slot, receive in every other
+
+// Slot actions, in the order they come in a cycle
+#define SLOT_BEACON 0    // coordinator sends the beacon
+#define SLOT_DATA 1      // this node sends its reading
+#define SLOT_RELAY 2     // this node relays the last frame it heard
+#define SLOT_JOIN 3      // a node that is not a member sends a join request
+#define SLOT_CYCLE_END 4 // the cycle is over
+
+// Cycles without a beacon before members drop the coordinator
+#define TDMA_BEACON_LOSS 3
+// Cycles a member may stay silent before the coordinator drops it
+#define TDMA_MEMBER_TIMEOUT 5
+// Network size a joining node waits two cycles of for a beacon, when the config doesn't list the nodes
+#define JOIN_LISTEN_MEMBERS 8
 
 // Indicates the start state of the node.
-int state = 7; // All nodes start in join request state
+int state = STATE_JOIN; // All nodes start by looking for a network to join
 
 // DNP3 packet struct
 struct DNP3Packet
@@ -79,11 +146,10 @@ struct DNP3Packet
   std::string time_stamp;
 };
 
-/** Create a timestamp using the computer's date and time and returns it as a sting.
+/** Formats the time now as a timestamp string.
 Received a string that would tell the fuction which format to use for the timestamp.*/
-std::string getCurrentDateTime(std::string s)
+std::string formatDateTime(time_t now, std::string s)
 {
-  time_t now = time(0);
   struct tm timeStruct;
   char timeStamp[20];
   timeStruct = *localtime(&now);
@@ -102,6 +168,13 @@ std::string getCurrentDateTime(std::string s)
   return std::string(timeStamp);
 }
 
+/** Create a timestamp using the computer's date and time and returns it as a sting.
+Received a string that would tell the fuction which format to use for the timestamp.*/
+std::string getCurrentDateTime(std::string s)
+{
+  return formatDateTime(time(0), s);
+}
+
 /* Received an array containing the data from the LoRa packet.
 It stores the data in a struct simulating the DNP3Packet and returns it.*/
 DNP3Packet DNP3PacketGenerator(std::array<std::string, 10> packetContent)
@@ -129,69 +202,74 @@ DNP3Packet DNP3PacketGenerator(std::array<std::string, 10> packetContent)
   return packet;
 }
 
-/* Received the array where the data of the LoRa packet is stored when the message is sent and the timestamp of when the packet was created.
- Extracts the data from the packet and returns a string array with the data and the timestamp of the packet*/
-std::array<std::string, 10> packetReader(uint8_t data[], std::string timeStamp)
+/* Received the decoded telemetry record of the LoRa packet.
+ Returns a string array with the data and the timestamp of the packet*/
+std::array<std::string, 10> packetReader(const TelemetryRecord &record)
 {
   std::array<std::string, 10> packetContent;
 
-  packetContent[0] = std::to_string(int(data[0]));
-  packetContent[1] = std::to_string(int(data[1]));
-  packetContent[2] = std::to_string(int(data[2]));
-  packetContent[3] = std::to_string(int(data[3]));
-  packetContent[4] = std::to_string(int(data[4]));
-  packetContent[5] = timeStamp;
+  packetContent[0] = std::to_string(record.phaseAngle);
+  packetContent[1] = std::to_string(record.busPhase);
+  packetContent[2] = std::to_string(record.powerFlow);
+  packetContent[3] = std::to_string(record.load);
+  packetContent[4] = std::to_string(int(record.status));
+  packetContent[5] = formatDateTime(record.timeStamp, packetTimeStamp);
 
   return packetContent;
 }
 
-/* This function receives the path to the where the file is gonna be saved, the name of the file and a array containing the data of the packetContent.
- It creates a file of type csv and writes a file in csv format of the data from the packet.
- It creates a log file of type txt that contains the date the file was created, the name of the file and its directory path .*/
-void fileWriter(std::string path, std::string fileName, std::array<std::string, 10> packetContent)
+/* Stores a reading from source unless it is a retry or rebroadcast of the last one stored.
+ Returns false for a duplicate. A reading dropped because the storage queue is full is not
+ recorded as seen, so a retry of it can still be stored.*/
+bool storeReading(uint8_t source, const TelemetryRecord &reading)
 {
-  std::string timeStamp = "";
-  bool fileWasCreated = false;
-  timeStamp = packetContent[5];
-
-  std::ofstream file;
-
-  // Concatenates the the path, fileName, timestamp and the type together into the variable fileDirectory.
-  std::string fileDirectory = path + fileName + timeStamp + ".csv";
-
-  // Creates the nodes data file. If the files doesn't exist it will be created and if the file exist it will just open it.
-  file.open(fileDirectory);
-
-  // If the file was able to be open it will write into the file else it will not write into the file.
-  // After the file was written it will close the file and chage the variable fileWasCreated to true.
-  if (file.is_open())
+  uint32_t now = (uint32_t)time(NULL);
+  if (dedup.contains(source, reading.timeStamp, now))
   {
-    file << "Substation Parameters,Values,Measurtments Units \n";
-    file << "Phase angle," + packetContent[0] + "," + "degrees \n";
-    file << "Phase on each bus," + packetContent[1] + "," + "kW \n";
-    file << "Power flow on each transmission line," + packetContent[2] + "," + "MW \n";
-    file << "Substation load," + packetContent[3] + "," + "kW \n";
-    file << "Substation component status," + packetContent[4] + "," + "boolean \n";
-    file.close();
-    fileWasCreated = true;
+    return false;
   }
 
-  // If fileWasCreated is true it will create and update the log file.
-  if (fileWasCreated)
+  StoredRecord record;
+  record.source = source;
+  record.reading = reading;
+  if (!storageWriter.push(record))
   {
-    // Creates the log file. If the files doesn't exist it will be created in append mode and if the file exist it will open it and update the contebts of the file.
-    file.open(path + "Node Data.log", std::ofstream ::app);
+    printf("Storage queue full, reading from %d dropped\n", source);
+  }
+  else
+  {
+    dedup.insert(source, reading.timeStamp, now);
+  }
+  return true;
+}
 
-    // If the file was able to be open it will write into the file else it will not write into the file.
-    // After the file was written it will close the file and chage the variable fileWasCreated to false.
-    if (file.is_open())
-    {
-      file << "[" + getCurrentDateTime(logTimeStamp) + "]" + " File created:[" << fileName + timeStamp + "]" + " File directory path:[" << fileDirectory + "]"
-                                                                                                                                                           "\n";
-      file.close();
-      fileWasCreated = false;
-    }
+/* Runs on the storage thread once a reading is handed to the store.
+ Prints the DNP3Packet of readings received from other nodes.*/
+void printStoredReading(const StoredRecord &record)
+{
+  if (record.source == config.address)
+  {
+    return;
   }
+
+  DNP3Packet packet = DNP3PacketGenerator(packetReader(record.reading));
+
+  // Prints to terminal the content of the DNP3Packet
+  std::cout << "DNP3Packet \n";
+  std::cout << packet.sync << "\n";
+  std::cout << packet.length << "\n";
+  std::cout << packet.link_control << "\n";
+  std::cout << packet.destination_address << "\n";
+  std::cout << packet.source_address << "\n";
+  std::cout << packet.crc << "\n";
+
+  std::cout << packet.phase_angle << "\n";
+  std::cout << packet.phase_on_each_bus << "\n";
+  std::cout << packet.power_flow_on_each_transmission_line << "\n";
+  std::cout << packet.substation_load << "\n";
+  std::cout << packet.substation_component_status << "\n";
+
+  std::cout << packet.time_stamp << "\n";
 }
 
 // Encrypt fuctions
@@ -478,66 +556,229 @@ void AESDecrypt(unsigned char *encryptedMessage, unsigned char *expandedKey, uns
   }
 }
 
-/**Method to verify if the last broadcast was sent from the node before your turn */
-bool prevNode(int prevnode_id, std::map<int, bool> node_map)
+/* Checks the fast AES engine against the reference functions above.
+ * Runs the FIPS-197 appendix C.1 vector and a set of random blocks under the given key
+ * on every engine available on this CPU. Returns false on the first mismatch.
+ */
+bool AESSelfTest(unsigned char *key)
 {
-  bool var = false; // boolean that indicates if it is prevNode
-  bool none = false;
-  std::map<int, bool>::iterator itr;
-  std::map<int, bool>::iterator pol;
-  pol = node_map.end();
-  pol->second = false;
-  pol = node_map.find(THIS_NODE_ADDRESS);
-  itr = node_map.find(prevnode_id);
-  // so we start on the node after
-  itr++;
-  for (; itr != node_map.end(); itr++)
+  unsigned char fipsKey[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+  unsigned char fipsPlain[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+  unsigned char fipsCipher[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+  AESEngine engines[2] = {AES_ENGINE_TTABLE, AES_ENGINE_AESNI};
+  AESEngine best = AESFastHaveNI() ? AES_ENGINE_AESNI : AES_ENGINE_TTABLE;
+  bool ok = true;
+
+  for (int e = 0; e < 2 && ok; e++)
   {
-    std::cout << itr->first << " :: " << itr->second << std::endl;
-    printf(" while 1");
-    if (itr->second == true) // If the node is "up"
+    if (!AESFastSetEngine(engines[e]))
     {
-      if (itr->first == THIS_NODE_ADDRESS) // If the node's id is MY id
-      {
-        itr = node_map.find(prevnode_id);
-        itr->second = false; // change previous node's status to false
-        var = true;
-        break;
-      }
-      break;
+      continue; // Not available on this CPU
     }
-    if (itr == node_map.end())
+
+    AESKeySchedule schedule;
+    unsigned char out[16];
+
+    AESFastExpandKey(fipsKey, &schedule);
+    AESFastEncrypt(&schedule, fipsPlain, out);
+    ok = ok && memcmp(out, fipsCipher, 16) == 0;
+    AESFastDecrypt(&schedule, fipsCipher, out);
+    ok = ok && memcmp(out, fipsPlain, 16) == 0;
+
+    // Random blocks under the network key, compared with AESEncrypt/AESDecrypt
+    unsigned char expandedKey[176];
+    KeyExpansion(key, expandedKey);
+    AESFastExpandKey(key, &schedule);
+    for (int n = 0; n < 64 && ok; n++)
     {
-      none = true;
-      break;
+      unsigned char block[16];
+      unsigned char reference[16];
+      for (int i = 0; i < 16; i++)
+      {
+        block[i] = rand() & 0xff;
+      }
+      AESEncrypt(block, expandedKey, reference);
+      AESFastEncrypt(&schedule, block, out);
+      ok = memcmp(out, reference, 16) == 0;
+      AESDecrypt(block, expandedKey, reference);
+      AESFastDecrypt(&schedule, block, out);
+      ok = ok && memcmp(out, reference, 16) == 0;
     }
   }
-  if (none)
+
+  AESFastSetEngine(best);
+  return ok;
+}
+
+// Writes a 32 bit sequence number big endian
+void writeSequence(uint8_t *p, uint32_t sequence)
+{
+  p[0] = sequence >> 24;
+  p[1] = sequence >> 16;
+  p[2] = sequence >> 8;
+  p[3] = sequence;
+}
+
+// Reads a 32 bit big endian sequence number
+uint32_t readSequence(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Reads the sequence number reserved by an earlier run from fileName.
+ * Returns 0 if there is none.
+ */
+uint32_t loadSequenceReserve(const std::string &fileName)
+{
+  uint8_t p[4];
+  FILE *file = fopen(fileName.c_str(), "rb");
+  if (file == NULL)
+  {
+    return 0;
+  }
+  bool ok = fread(p, sizeof(p), 1, file) == 1;
+  fclose(file);
+  return ok ? readSequence(p) : 0;
+}
+
+/* Saves reserve to fileName and flushes it to disk, so a restart never sends a sequence number below it.
+ * Writes a new file and renames it over the old one. Returns false on error.
+ */
+bool saveSequenceReserve(const std::string &fileName, uint32_t reserve)
+{
+  std::string tempName = fileName + ".tmp";
+  uint8_t p[4];
+  FILE *file = fopen(tempName.c_str(), "wb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  writeSequence(p, reserve);
+  bool ok = fwrite(p, sizeof(p), 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+  ok = fclose(file) == 0 && ok;
+  return ok && rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+/* The CCM nonce is the source node and its sequence number, zero padded.
+ * Each node counts its own sequence, so no two frames share a nonce under the network key.
+ * The count carries on across restarts from the reserve saved in the data path.
+ */
+void frameNonce(uint8_t nonce[AES_CCM_NONCE_LEN], uint8_t source, const uint8_t *sequence)
+{
+  memset(nonce, 0, AES_CCM_NONCE_LEN);
+  nonce[0] = source;
+  memcpy(nonce + 1, sequence, 4);
+}
+
+/* Builds a sealed data frame in frame and returns its length.
+ * The payload is encrypted with AES-CCM and followed by the MIC.
+ */
+uint8_t sealFrame(uint8_t *frame, uint8_t source, uint32_t sequence, const uint8_t *plain, uint8_t len, const AESKeySchedule *schedule)
+{
+  uint8_t nonce[AES_CCM_NONCE_LEN];
+
+  frame[FRAME_SOURCE] = source;
+  writeSequence(frame + FRAME_SEQUENCE, sequence);
+  frameNonce(nonce, source, frame + FRAME_SEQUENCE);
+  AESCCMEncrypt(schedule, nonce, NULL, 0, plain, len, frame + FRAME_PAYLOAD, frame + FRAME_PAYLOAD + len);
+
+  return len + FRAME_OVERHEAD;
+}
+
+/* Checks the MIC of a received data frame and decrypts its payload into plain.
+ * On entry *len is the size of plain, on success it is set to the payload length.
+ * Returns false if the frame is too short, too long or was modified.
+ */
+bool openFrame(const uint8_t *frame, uint8_t frameLen, uint8_t *plain, uint8_t *len, const AESKeySchedule *schedule)
+{
+  uint8_t nonce[AES_CCM_NONCE_LEN];
+
+  if (frameLen <= FRAME_OVERHEAD || frameLen - FRAME_OVERHEAD > *len)
+  {
+    return false;
+  }
+  *len = frameLen - FRAME_OVERHEAD;
+  frameNonce(nonce, frame[FRAME_SOURCE], frame + FRAME_SEQUENCE);
+  return AESCCMDecrypt(schedule, nonce, NULL, 0, frame + FRAME_PAYLOAD, *len, frame + FRAME_PAYLOAD + *len, plain);
+}
+
+/* True if the header flag and frame length are those of a sealed telemetry record. */
+bool isDataFrame(uint8_t headerFlags, uint8_t frameLen)
+{
+  return (headerFlags == FRAME_KIND_DATA || headerFlags == FRAME_KIND_RELAY) && frameLen >= FRAME_OVERHEAD + TELEMETRY_RECORD_MIN_LEN &&
+         frameLen <= FRAME_OVERHEAD + TELEMETRY_RECORD_MAX_LEN;
+}
+
+/* Broadcasts a frame with headerFlags in the radio header. Returns false if it could not be sent. */
+bool sendFrame(uint8_t headerFlags, const uint8_t *frame, uint8_t len)
+{
+  manager.setHeaderFlags(headerFlags, 0xff);
+  return manager.sendto((uint8_t *)frame, len, RH_BROADCAST_ADDRESS);
+}
+
+/* Time on air in ms of an application frame of len bytes with the radio's current modem config,
+ including the compact RH_RF95 header. */
+uint32_t frameAirtime(uint8_t len)
+{
+  return rf95.timeOnAir(len);
+}
+
+/* Finds the first thing this node does in a cycle after offset ms from its start.
+ Sets action and returns its offset, or returns the cycle length with SLOT_CYCLE_END when nothing is left. */
+uint32_t nextSlotAction(const TdmaSchedule &schedule, int state, uint32_t after, int *action)
+{
+  uint32_t best = schedule.cycleLength();
+  int slot = schedule.slotOf(config.address);
+  uint32_t offsets[4];
+  int actions[4];
+  int n = 0;
+
+  *action = SLOT_CYCLE_END;
+  if (state == STATE_MEMBER && schedule.coordinator() == config.address)
+  {
+    offsets[n] = TDMA_GUARD;
+    actions[n++] = SLOT_BEACON;
+  }
+  if (state == STATE_MEMBER && slot >= 0)
+  {
+    offsets[n] = schedule.memberSlotOffset(slot) + TDMA_GUARD;
+    actions[n++] = SLOT_DATA;
+    offsets[n] = schedule.memberSlotOffset(slot) + schedule.relayOffset();
+    actions[n++] = SLOT_RELAY;
+  }
+  if (state == STATE_JOIN)
+  {
+    offsets[n] = schedule.joinSlotOffset() + TDMA_GUARD;
+    actions[n++] = SLOT_JOIN;
+  }
+
+  for (int i = 0; i < n; i++)
   {
-    for (itr = node_map.begin(); itr != node_map.end(); itr++)
+    if (offsets[i] > after && offsets[i] < best)
     {
-      std::cout << itr->first << " :: " << itr->second << std::endl;
-      printf(" for 1");
-      if (itr->second == true)
-      {
-        if (itr->first == THIS_NODE_ADDRESS)
-        {
-          itr = node_map.find(prevnode_id);
-          itr->second = false;
-          var = true;
-          break;
-        }
-        break;
-      }
+      best = offsets[i];
+      *action = actions[i];
     }
   }
-  printf("return var\n");
-  return var;
+  return best;
+}
+
+// Arms the slot timer for the millis() value due, straight away if it has passed
+void armSlotTimer(unsigned long due)
+{
+  long remaining = (long)(due - millis());
+  eventLoop.arm(TIMER_SLOT, remaining > 0 ? remaining : 0);
 }
 
 // Main Function
 int main(int argc, const char *argv[])
 {
+  // rf95_test [config file]
+  const char *configFile = argc > 1 ? argv[1] : NODE_CONFIG_FILE;
+  if (!NodeConfigLoad(configFile, &config))
+  {
+    return 1;
+  }
 
   if (gpioInitialise() < 0) // pigpio library function that initiliazes gpio
   {
@@ -546,6 +787,13 @@ int main(int argc, const char *argv[])
   }
   gpioSetSignalFunc(2, sig_handler); // 2 is SIGINT. Ctrl+C will cause signal.
 
+  if (!eventLoop.init())
+  {
+    printf("\n Event loop could not be created");
+    return 1;
+  }
+  attachInterruptHook(radio_interrupt); // DIO0 wakes the main loop
+
   // Verify Raspi startup
   printf("\nRPI rf95_test startup OK.\n");
   printf("\nRPI GPIO settings:\n");
@@ -559,6 +807,7 @@ int main(int argc, const char *argv[])
     return 1;
   }
 
+  manager.setThisAddress(config.address);
   if (!manager.init())
   {
     printf("\n\nMesh Manager Failed to initialize.\n\n");
@@ -569,975 +818,443 @@ int main(int argc, const char *argv[])
   printf("\nRFM 95 Settings:\n");
   printf("Frequency= %d MHz\n", (uint16_t)RFM95_FREQUENCY);
   printf("Power= %d\n", (uint8_t)RFM95_TXPOWER);
-  printf("This Address= %d\n", THIS_NODE_ADDRESS);
+  printf("This Address= %d\n", config.address);
   rf95.setTxPower(RFM95_TXPOWER, true);
   rf95.setFrequency(RFM95_FREQUENCY);
   rf95.setModemConfig(RH_RF95::Bw125Cr48Sf4096);
+  rf95.setCompactHeader(true);
   // Bw500Cr45Sf128
   /* End Manager/Driver settings code */
 
-  /*Node map status initialise*/
-  node_status_map.insert(std::pair<int, bool>(NODE1_ADDRESS, false));
-  node_status_map.insert(std::pair<int, bool>(NODE2_ADDRESS, false));
-  node_status_map.insert(std::pair<int, bool>(THIS_NODE_ADDRESS, false));
-  node_status_map.insert(std::pair<int, bool>(NODE4_ADDRESS, false));
-  node_status_map.insert(std::pair<int, bool>(NODE5_ADDRESS, false));
-  node_status_map.insert(std::pair<int, bool>(NODE6_ADDRESS, false));
+  if (config.nodes.count() > 0)
+  {
+    printf("Known nodes= %d\n", config.nodes.count());
+  }
 
-  // File wrIter variables
-  std::array<std::string, 10> packetContent;
-  DNP3Packet packet;
+  // Slot lengths follow from the airtime of the largest data, ack and join frames, so setModemConfig() must come first
+  TdmaSchedule schedule;
+  schedule.setFrames(frameAirtime, FRAME_OVERHEAD + TELEMETRY_RECORD_MAX_LEN, ACK_FRAME_LEN, JOIN_FRAME_LEN);
+  printf("Data frame airtime= %u ms, slot= %u ms\n", frameAirtime(FRAME_OVERHEAD + TELEMETRY_RECORD_MAX_LEN), schedule.memberSlotLength());
 
   /* Placeholder Message  */
   uint8_t data[50];
+  uint8_t datalen = 0;
   uint8_t buf[50];
   uint8_t dupe_buf[50];
-  uint8_t turn[10];
   /* End Placeholder Message */
 
   // Encryption key
   unsigned char key[16] = {0x01, 0x04, 0x02, 0x03, 0x01, 0x03, 0x04, 0x0a, 0x09, 0x0b, 0x07, 0x0f, 0x0c, 0x06, 0x03, 0x00};
 
-  char message[50];
-
-  /* timeouts start */
-  // retry to send your broadcast
-  unsigned long retrySend = 15000;
-  unsigned long retryStartTimer;
-  // Node turn timer
-  unsigned long turnTimer = 60000;
-  unsigned long startTurnTimer;
-  // Join request resend timer
-  unsigned long joinResendTimer = 15000;
-  unsigned long joinResendStartTimer;
-  // Retry sending turn
-  unsigned long retry_turn_timeout = 15000;
-  unsigned long retry_turn_timer;
-  // wait 7 seconds in receive mode to make receiving join requests easier
-  unsigned long wait_timer;
-  // last broadcast received timout
-  unsigned long last_broadcast_received = 60000;
-  unsigned long last_broadcast_received_timer;
-
-  /* timeouts end */
-
-  // Keep track of how many times the node has resent the join request.
-  int retry = 0;
-  // Keep track of how many times the node has resent the turn message.
-  int turn_retry = 0;
-  // Edge case where there are only 2 nodes in the network.
-  bool two_nodes = false;
-  // Edge case
-  bool master_node = false;
-  // Acknowledge the turn message
-  bool turn_ack = false;
-  // new node has joined the network
-  bool new_node = false;
-  // new node id
-  int new_node_id = 0;
-  // wait in receive for any join requests
-  bool send_turn = false;
-  // Network Session Key (4 digits)
-  uint8_t NSK;
-  // Keep track of who sent the join request
-  uint8_t _from;
-
-  uint8_t from, to; // stores the address of the node that the message was from, and the destination address respectively
-  uint8_t buflen = sizeof(buf);
-  uint8_t dupe_buflen = sizeof(buf);
-
-  while (!flag)
+  // Verify the fast AES engine against the reference implementation
+  if (!AESSelfTest(key) || !AESCCMSelfTest())
   {
-    /*State 1: Node sends broadcast of DNP3 packet*/
-    if (state == 1) // sending
-    {
-      sleep(2);
-      master_node = true;
-      uint8_t datalen = sizeof(data);
-      std::string timeStamp = "";
-      data[0] = RH_FLAGS_RETRY;
-
-      // Providing a seed value
-      srand((unsigned)time(NULL));
-
-      // Generates random data simulating the data from the substation
-      message[0] = 1 + (rand() % 91);
-      message[1] = 1 + (rand() % 101);
-      message[2] = 1 + (rand() % 101);
-      message[3] = 1 + (rand() % 101);
-      message[4] = 0 + (rand() % 2);
-
-      std::cout << "Message to encrypt:" << std::endl;
-      printf("%d", message[0]);
-      std::cout << " ";
-      printf("%d", message[1]);
-      std::cout << " ";
-      printf("%d", message[2]);
-      std::cout << " ";
-      printf("%d", message[3]);
-      std::cout << " ";
-      printf("%d", message[4]);
-      std::cout << " ";
-
-      timeStamp = getCurrentDateTime(packetTimeStamp);
-
-      int j = 0;
-
-      for (int i = 5; i <= 23; i++)
-      {
-        message[i] = timeStamp[j];
-        j++;
-        std::cout << message[i];
-      }
-
-      std::cout << std::endl;
-
-      // Pad message to 16 bytes
-      int originalLen = 24;
-
-      int paddedMessageLen = originalLen;
-
-      if ((paddedMessageLen % 16) != 0)
-      {
-        paddedMessageLen = (paddedMessageLen / 16 + 1) * 16;
-      }
-
-      unsigned char *paddedMessage = new unsigned char[paddedMessageLen];
-      for (int i = 0; i < paddedMessageLen; i++)
-      {
-        if (i >= originalLen)
-        {
-          paddedMessage[i] = 0;
-        }
-        else
-        {
-          paddedMessage[i] = message[i];
-        }
-      }
+    printf("\n\nAES engine self test failed.\n\n");
+    return 1;
+  }
 
-      unsigned char *encryptedMessage = new unsigned char[paddedMessageLen];
+  // Round keys are expanded once here and reused for every packet
+  AESKeySchedule keySchedule;
+  AESFastExpandKey(key, &keySchedule);
+  printf("AES engine= %s\n", AESFastEngineName());
+
+  /* Sequence number of the last data frame sent. A restarted node carries on from the reserve saved by
+  the last run, so it never reuses a nonce it already sent under the same key. Numbers are reserved
+  SEQUENCE_RESERVE at a time, so the file is written once per SEQUENCE_RESERVE frames. The clock is
+  the fallback for a node with no saved reserve. */
+  std::string sequenceFile = config.dataPath + "sequence.reserve";
+  uint32_t txSequence = loadSequenceReserve(sequenceFile);
+  if (txSequence < (uint32_t)time(NULL))
+  {
+    txSequence = (uint32_t)time(NULL);
+  }
+  uint32_t txReserved = txSequence + SEQUENCE_RESERVE;
+  if (!saveSequenceReserve(sequenceFile, txReserved))
+  {
+    printf("\nSequence reserve could not be saved in %s, a restart may reuse nonces.\n", sequenceFile.c_str());
+  }
 
-      unsigned char expandedKey[176];
+  // Reading this node broadcasts, kept until it is acknowledged and saved
+  TelemetryRecord reading;
+  // The reading in data has been acknowledged, so the next slot carries a new one
+  bool acked = true;
+
+  // Providing a seed value
+  srand((unsigned)time(NULL));
+
+  /* schedule start */
+  // The schedule's timing is known, from a beacon or from creating the network
+  bool synced = false;
+  // millis() at the start of the current cycle and its number
+  unsigned long cycleStart = 0;
+  uint32_t cycle = 0;
+  // Next slot action and its offset from cycleStart
+  int action = SLOT_CYCLE_END;
+  uint32_t actionOffset = 0;
+  // A beacon arrived during this cycle
+  bool beaconHeard = false;
+  // Cycles in a row without a beacon
+  int missedBeacons = 0;
+  // Cycle in which each address was last heard, for the coordinator to drop silent members
+  uint32_t lastHeard[256];
+  memset(lastHeard, 0, sizeof(lastHeard));
+  // Join requests the coordinator admits at the next cycle boundary
+  Roster pendingJoins;
+  // Join listen timer: no beacon heard for two cycles of a network of every known node means there is no network yet
+  unsigned long joinListenTimeout = 2 * schedule.cycleLength(config.nodes.count() > 0 ? config.nodes.count() : JOIN_LISTEN_MEMBERS);
+  unsigned long joinListenStartTimer = millis();
+  eventLoop.arm(TIMER_JOIN_LISTEN, joinListenTimeout);
+  /* schedule end */
+
+  uint8_t from; // stores the address of the node that the message was from
+  uint8_t headerFlags; // stores the header flag that says what kind of frame it is
+  uint8_t buflen = sizeof(buf);
+  uint8_t dupe_buflen = 0;
 
-      KeyExpansion(key, expandedKey);
+  if (!store.open(config.dataPath))
+  {
+    printf("\nRecord store could not be opened in %s, readings will not be saved.\n", config.dataPath.c_str());
+  }
+  if (!dedup.open(config.dataPath + "dedup.bloom", (uint32_t)time(NULL)))
+  {
+    printf("No saved duplicate filter, starting with an empty one.\n");
+  }
+  if (!storageWriter.start(&store, printStoredReading))
+  {
+    printf("\n\nStorage writer thread could not be started.\n\n");
+    return 1;
+  }
+  eventLoop.arm(TIMER_HOUSEKEEPING, STORAGE_REPORT_INTERVAL);
 
-      // Encrypt the message
-      for (int i = 0; i < paddedMessageLen; i += 16)
-      {
-        AESEncrypt(paddedMessage + i, expandedKey, encryptedMessage + i);
-      }
+  while (!flag)
+  {
+    /* Between slot actions the node only waits for a frame or a timer. Sleep until the radio
+    interrupts or a timer fires instead of polling recvfrom() and millis() in a spin. */
+    if (!rf95.available())
+    {
+      uint32_t events = eventLoop.wait(LOOP_MAX_SLEEP);
 
-      // Prints the encrypted message in hex form
-      std::cout << "Encrypted message in hex:" << std::endl;
-      for (int i = 0; i < paddedMessageLen; i++)
+      if (events & LOOP_TIMER_EVENT(TIMER_HOUSEKEEPING))
       {
-        std::cout << std::hex << (int)encryptedMessage[i];
-        std::cout << " ";
-        data[i + 2] = encryptedMessage[i];
+        dedup.poll((uint32_t)time(NULL));
+        printf("storage queue %u (max %u), written %lu, dropped %lu, failed %lu\n", storageWriter.depth(), storageWriter.highWater(),
+               storageWriter.written(), storageWriter.dropped(), storageWriter.failed());
+        eventLoop.arm(TIMER_HOUSEKEEPING, STORAGE_REPORT_INTERVAL);
       }
-
-      std::cout << std::endl;
-
-      startTurnTimer = millis();
-      if (manager.sendto(data, datalen, RH_BROADCAST_ADDRESS))
+      if (events & LOOP_EVENT_STOP)
       {
-        printf((char *)&data);
-        printf("\n");
-        printf("size %d\n", datalen);
-        printf("Sending broadcast... \n");
-        // wait for packet to be sent
-        rf95.waitPacketSent();
-        printf("waited \n");
-        rf95.setModeRx();
-        state = 2;
+        break;
       }
-      retryStartTimer = millis();
     }
-    /*State 2: Node receives acknowledgement from other node that its broadcast was received
-    If the acknowledgement was not received, keep resending the message*/
-    else if (state == 2) // recv ack
-    {
-      if (manager.recvfrom(buf, &buflen, &from))
-      {
-        uint8_t decrypMessage[50];
-
-        int encryptedMessageLen = 32;
-
-        unsigned char *_encryptedMessage = new unsigned char[encryptedMessageLen];
-
-        for (int i = 0; i < encryptedMessageLen; i++)
-        {
-          _encryptedMessage[i] = (unsigned char)buf[i + 2];
-        }
-
-        unsigned char expandedKeyDecrypt[176];
-
-        KeyExpansion(key, expandedKeyDecrypt);
-
-        unsigned char *decryptedMessage = new unsigned char[encryptedMessageLen];
 
-        // Decrypt the message
-        for (int i = 0; i < encryptedMessageLen; i += 16)
-        {
-          AESDecrypt(_encryptedMessage + i, expandedKeyDecrypt, decryptedMessage + i);
-        }
-
-        int decryptMessageLen = 24;
-
-        // Prints the decrypted message in hex form
-        std::cout << "Decrypted message in hex:" << std::endl;
-        for (int i = 0; i < decryptMessageLen; i++)
-        {
-          std::cout << std::hex << (int)decryptedMessage[i];
-          std::cout << " ";
-        }
-
-        std::cout << std::endl;
-
-        // Prints the decrypted message
-        std::cout << "Decrypted message:" << std::endl;
-
-        printf("%d", decryptedMessage[0]);
-        std::cout << " ";
-        printf("%d", decryptedMessage[1]);
-        std::cout << " ";
-        printf("%d", decryptedMessage[2]);
-        std::cout << " ";
-        printf("%d", decryptedMessage[3]);
-        std::cout << " ";
-        printf("%d", decryptedMessage[4]);
-        std::cout << " ";
-
-        for (int i = 5; i < decryptMessageLen; i++)
-        {
-          std::cout << decryptedMessage[i];
-        }
-
-        std::cout << std::endl;
-
-        for (int i = 0; i < decryptMessageLen; i++)
-        {
-          decrypMessage[i] = decryptedMessage[i];
-        }
+    /* Receive: frames are handled the same way in every slot */
+    buflen = sizeof(buf);
+    if (manager.recvfrom(buf, &buflen, &from, NULL, NULL, &headerFlags))
+    {
+      unsigned long received = millis();
+      uint8_t coordinator;
+      uint32_t beaconCycle;
+      Roster members;
 
-        if ((int)buf[1] == THIS_NODE_ADDRESS) // If acknowledgement was directed towards this node, print it, verify its integrity and store it
+      lastHeard[from] = cycle;
+      if (headerFlags == FRAME_KIND_BEACON && TdmaSchedule::decodeBeacon(buf, buflen, &coordinator, &beaconCycle, &members))
+      {
+        /* Follow the beacon of this node's coordinator, or of a lower coordinator whose network this one merges into.
+        A beacon from a higher coordinator of another network is ignored, that network joins this one instead. */
+        if (!synced || coordinator <= schedule.coordinator() || schedule.slotOf(coordinator) >= 0)
         {
-          Serial.print("Got acknowledgement from : 0x");
-          Serial.print(from);
-          Serial.print(": ");
-          Serial.println((char *)&buf);
-
-          std::string timeStamp = "";
-          char temp[50] = "";
-          int len = 0;
-
-          // Checks message integrity by comparing it with the ack you receive
-          while (len < 24)
+          schedule.setMembers(members);
+          // Members named by the coordinator count as heard, so a member that takes over as coordinator doesn't drop them at once
+          for (uint8_t i = 0; i < members.count(); i++)
           {
-            if (decrypMessage[len] == message[len])
-            {
-              len++;
-            }
-            else
-            {
-              break;
-            }
+            lastHeard[members.at(i)] = beaconCycle;
           }
-
-          int j = 0;
-
-          for (int i = 5; i <= 24; i++)
+          cycle = beaconCycle;
+          // The beacon went out one guard time after the cycle started
+          cycleStart = received - schedule.beaconAirtime() - TDMA_GUARD;
+          synced = true;
+          beaconHeard = true;
+          missedBeacons = 0;
+          eventLoop.disarm(TIMER_JOIN_LISTEN);
+
+          if (state == STATE_JOIN && schedule.slotOf(config.address) >= 0)
           {
-            temp[j] = decryptedMessage[i];
-            j++;
+            printf("Joined the network of %d, slot %d of %d\n", coordinator, schedule.slotOf(config.address), members.count());
+            state = STATE_MEMBER;
           }
-
-          timeStamp = temp;
-
-          // If ack is the same as the message you send save your own data
-          if (len == 24)
+          else if (state == STATE_MEMBER && schedule.slotOf(config.address) < 0)
           {
-            fileName = "Node3 Data ";
-            packetContent = packetReader(decrypMessage, timeStamp);
-            fileWriter(path, fileName, packetContent);
+            printf("Not in the beacon of %d, joining again\n", coordinator);
+            state = STATE_JOIN;
           }
-          // rf95.waitAvailableTimeout(1000); // wait time available inside of 15s
-          state = 13;
+          pendingJoins.clear();
+
+          actionOffset = nextSlotAction(schedule, state, received - cycleStart, &action);
+          armSlotTimer(cycleStart + actionOffset);
         }
       }
-      else if (millis() - retryStartTimer >= retrySend && (millis() - startTurnTimer <= turnTimer)) // Has not received ackowledgement and its turn is not over
-      {
-        state = 6; // retry send
-      }
-      else if (millis() - startTurnTimer >= turnTimer) ////Has not received ackowledgement and its turn is  over
+      else if (headerFlags == FRAME_KIND_JOIN_REQUEST && buflen == JOIN_FRAME_LEN) // Join request, answered by the next beacon
       {
-        state = 4; // send broadcast - tell next node its his turn
-        printf("turn over timeout\n");
-      }
-
-      send_turn = true;
-      wait_timer = millis();
-      last_broadcast_received_timer = millis();
-    }
-    /*State 3: Node sends acknowledgement that a broadcast or a turn broadcast was received*/
-    else if (state == 3) // send ack and turn ack
-    {
-      // If broadcast received was a turn broadcast, send a turn acknowledgement
-      if (turn_ack == true)
-      {
-        uint8_t turn_ackarr[50];
-        uint8_t turn_ackarrlen = sizeof(turn_ackarr);
-        turn_ackarr[0] = RH_FLAGS_ACK;
-        turn_ackarr[1] = from;
-        if (manager.sendto(turn_ackarr, turn_ackarrlen, RH_BROADCAST_ADDRESS))
+        printf("Got join request from %d\n", (int)from);
+        if (state == STATE_MEMBER && schedule.coordinator() == config.address && (config.nodes.count() == 0 || config.nodes.contains(from)))
         {
-          printf("Sending turn acknowledgement \n");
-          // wait for packet to be sentlast_broadcast_received_timer = millis();
-          rf95.waitPacketSent();
-          printf("waited \n");
-          rf95.setModeRx();
-          state = 1;
-          turn_ack = false;
+          pendingJoins.add(from);
         }
-        startTurnTimer = millis();
       }
-      // If broadcast received was a normal broadcast, send a normal acknowledgement
-      else
+      else if (headerFlags == FRAME_KIND_ACK && buflen == ACK_FRAME_LEN)
       {
-        srand((unsigned)rand());
-        // random delay so not all nodes send an acknowledgement at the same time
-        int sleepTime = 0 + (rand() % 6);
-        sleep(sleepTime);
-        printf("rand %d \n", sleepTime);
-        buf[0] = RH_FLAGS_ACK;
-        buf[1] = from;
-        if (manager.sendto(buf, buflen, RH_BROADCAST_ADDRESS))
+        // Acknowledgement for the frame this node sent: its source and sequence number.
+        // The receiver already checked the MIC, so there is nothing to decrypt or compare here.
+        if ((int)buf[FRAME_SOURCE] == config.address && readSequence(buf + FRAME_SEQUENCE) == txSequence && !acked)
         {
-          printf("Sending acknowledgement \n");
-          // wait for packet to be sent
-          rf95.waitPacketSent();
-          printf("waited \n");
-          rf95.setModeRx();
-          state = 4;
+          Serial.print("Got acknowledgement from : 0x");
+          Serial.print(from);
+          Serial.print(": ");
+          printf("sequence %u\n", readSequence(buf + FRAME_SEQUENCE));
+
+          // Save your own data now that another node holds a copy of it
+          storeReading(config.address, reading);
+          acked = true;
         }
-      }
-      sleep(2);
-    }
-    /*State 4: Node receives: message that indicates a new node joined the network, join request, turn broadcast, acknowledgement */
-    else if (state == 4) // recv
-    {
-      if (manager.recvfrom(buf, &buflen, &from))
-      {
-        printf("len %d\n", buflen);
-        printf("recvd something\n");
-        last_broadcast_received_timer = millis();
-        if (buflen <= 30)
+        else
         {
-          if ((int)buf[0] == RH_FLAGS_JOIN_REQUEST) // Broadcast that indicates a new node joined the network
-          {
-            printf(" A new node joined the network\n");
-            std::map<int, bool>::iterator itr;
-            itr = node_status_map.find((int)buf[2]);
-            printf("id %d, %d, buf %d\n", itr->first, itr->second, (int)buf[2]);
-            if (itr->second == false && itr != node_status_map.end())
-            {
-              itr->second = true;
-              new_node = true;
-              new_node_id = (int)buf[2];
-            }
-          }
-          if (buflen <= 13) // Turn Broadcast was received
-          {
-            printf("Received a turn broadcast\n");
-            printf("id %d\n", (int)buf[1]);
-            if ((int)buf[1] == THIS_NODE_ADDRESS) // Verify if it is this node's turn
-            {
-              Serial.print("Got message that it's MY turn: 0x");
-              Serial.print(from);
-              Serial.print(": ");
-              Serial.println((char *)buf);
-              rf95.waitAvailableTimeout(1000);
-              _from = from;
-              state = 3; // send turn msg ack
-              turn_ack = true;
-            }
-          }
-          buflen = 50;
+          printf("Got acknowledgement, but it's not for me!\n");
         }
-        else if ((int)buf[0] == RH_FLAGS_JOIN_REQUEST) // Join Request Broadcast was received
+      }
+      else if (isDataFrame(headerFlags, buflen))
+      {
+        uint8_t decryptedMessage[TELEMETRY_RECORD_MAX_LEN];
+        uint8_t decryptMessageLen = sizeof(decryptedMessage);
+        TelemetryRecord record;
+
+        // Integrity is checked on receipt. A frame that fails the MIC is not stored, acknowledged or relayed
+        if (!openFrame(buf, buflen, decryptedMessage, &decryptMessageLen, &keySchedule))
         {
-          printf("Got join request \n");
-          state = 9;
-          _from = from;
-          new_node = true;
-          new_node_id = _from;
+          std::cout << "Broadcast failed the integrity check, dropped" << std::endl;
         }
-        else if ((int)buf[0] == RH_FLAGS_ACK) // Acknowledgement that is not for this node
+        else if (!TelemetryDecode(decryptedMessage, decryptMessageLen, &record))
         {
-          printf("Got acknowledgement, but it's not for me!\n");
+          std::cout << "Broadcast carries an unknown record format, dropped" << std::endl;
         }
         else
         {
-          // Save data received to be rebroadcasted in state 13
-          if (RH_FLAGS_RETRY == (int)buf[0])
+          // Only the sender's successor acknowledges, straight away inside the sender's ack window
+          if (headerFlags == FRAME_KIND_DATA && state == STATE_MEMBER && schedule.successor(buf[FRAME_SOURCE]) == config.address)
           {
-            for (int i = 2; i <= buflen; i++)
+            // The frame passed its MIC check, so the ack only names it: source and sequence number
+            uint8_t ack[ACK_FRAME_LEN];
+            ack[FRAME_SOURCE] = buf[FRAME_SOURCE];
+            memcpy(ack + FRAME_SEQUENCE, buf + FRAME_SEQUENCE, 4);
+            if (sendFrame(FRAME_KIND_ACK, ack, sizeof(ack)))
             {
-              dupe_buf[i] = buf[i];
-              std::cout << std::hex << (int)dupe_buf[i];
-              std::cout << " ";
-              std::cout << std::hex << (int)buf[i];
-              std::cout << " ";
-              std::cout << std::endl;
+              printf("Sending acknowledgement \n");
+              rf95.waitPacketSent();
+              rf95.setModeRx();
             }
           }
 
-          if (buf[2] != 0)
+          // Save original frames to relay in this node's next slot
+          if (headerFlags == FRAME_KIND_DATA)
           {
+            memcpy(dupe_buf, buf, buflen);
+            dupe_buflen = buflen;
+          }
 
-            last_broadcast_received_timer = millis();
-
-            uint8_t decrypMessage[50];
-
-            int encryptedMessageLen = 32;
-
-            unsigned char *_encryptedMessage = new unsigned char[encryptedMessageLen];
-            for (int i = 0; i < encryptedMessageLen; i++)
-            {
-              _encryptedMessage[i] = (unsigned char)buf[i + 2];
-            }
-
-            unsigned char expandedKeyDecrypt[176];
-
-            KeyExpansion(key, expandedKeyDecrypt);
-
-            unsigned char *decryptedMessage = new unsigned char[encryptedMessageLen];
-
-            // Decrypt the message
-            for (int i = 0; i < encryptedMessageLen; i += 16)
-            {
-              AESDecrypt(_encryptedMessage + i, expandedKeyDecrypt, decryptedMessage + i);
-            }
-
-            int decryptMessageLen = 24;
-
-            // Prints the decrypted message in hex form
-            std::cout << "Decrypted message in hex:" << std::endl;
-            for (int i = 0; i < decryptMessageLen; i++)
-            {
-              std::cout << std::hex << (int)decryptedMessage[i];
-              std::cout << " ";
-            }
-
-            std::cout << std::endl;
-
-            // Prints the decrypted message
-            std::cout << "Decrypted message:" << std::endl;
-
-            printf("%d", decryptedMessage[0]);
-            std::cout << " ";
-            printf("%d", decryptedMessage[1]);
-            std::cout << " ";
-            printf("%d", decryptedMessage[2]);
-            std::cout << " ";
-            printf("%d", decryptedMessage[3]);
-            std::cout << " ";
-            printf("%d", decryptedMessage[4]);
+          // Prints the decrypted message in hex form
+          std::cout << "Decrypted message in hex:" << std::endl;
+          for (int i = 0; i < decryptMessageLen; i++)
+          {
+            std::cout << std::hex << (int)decryptedMessage[i];
             std::cout << " ";
+          }
 
-            for (int i = 5; i < decryptMessageLen; i++)
-            {
-              std::cout << decryptedMessage[i];
-            }
-
-            std::cout << std::endl;
-
-            for (int i = 0; i < decryptMessageLen; i++)
-            {
-              decrypMessage[i] = decryptedMessage[i];
-            }
-
-            // timer since last broadcast received
-            if ((int)buf[0] == RH_FLAGS_RETRY)
-            {
-              state = 3;
-            }
-            rf95.waitAvailableTimeout(1000);
-
-            std::string timeStamp = "";
-            char temp[50] = "";
-            int j = 0;
-
-            // extract data
-            for (int i = 5; i <= 24; i++)
-            {
-              temp[j] = decryptedMessage[i];
-              j++;
-            }
-
-            timeStamp = temp;
-
-            packetContent = packetReader(decrypMessage, timeStamp);
-
-            // Creates the name from the file according to the id of the node that send the packet
-            if ((int)from == NODE1_ADDRESS)
-            {
-              fileName = "Node1 Data ";
-            }
-            else if ((int)from == NODE2_ADDRESS)
-            {
-              fileName = "Node2 Data ";
-            }
-            else if ((int)from == THIS_NODE_ADDRESS)
-            {
-              fileName = "Node3 Data ";
-            }
-            else if ((int)from == NODE4_ADDRESS)
-            {
-              fileName = "Node4 Data ";
-            }
-            else if ((int)from == NODE5_ADDRESS)
-            {
-              fileName = "Node5 Data ";
-            }
-            else if ((int)from == NODE6_ADDRESS)
-            {
-              fileName = "Node6 Data ";
-            }
-
-            std::ifstream file;
-
-            // Concatenates the the path, fileName, timestamp and the type together into the variable fileDirectory.
-            std::string fileDirectory = path + fileName + timeStamp + ".csv";
-
-            // Creates the nodes data file. If the file exist it will open it.
-            file.open(fileDirectory);
+          std::cout << std::endl;
 
-            // If the file was able to be open it will write into the file else it will not write into the file.
-            // After the file was written it will close the file and chage the variable fileWasCreated to true.
-            if (file.is_open())
-            {
-              file_exists = true;
-              file.close();
-            }
+          // Prints the decrypted message
+          std::cout << "Decrypted message:" << std::endl;
+          printf("%u %u %u %u %d %u\n", record.phaseAngle, record.busPhase, record.powerFlow, record.load, record.status, record.timeStamp);
 
-            if (file_exists || timeStamp == "")
-            {
-              std::cout << "File already exists" << std::endl;
-              file_exists = false;
-            }
-            else
-            {
-              Serial.print("Got broadcast from : 0x");
-              Serial.print(from);
-              Serial.print(": ");
-              Serial.println((char *)buf);
-
-              fileWriter(path, fileName, packetContent);
-
-              packet = DNP3PacketGenerator(packetContent);
-
-              // Prints to terminal the content of the DNP3Packet
-              std::cout << "DNP3Packet \n";
-              std::cout << packet.sync << "\n";
-              std::cout << packet.length << "\n";
-              std::cout << packet.link_control << "\n";
-              std::cout << packet.destination_address << "\n";
-              std::cout << packet.source_address << "\n";
-              std::cout << packet.crc << "\n";
-
-              std::cout << packet.phase_angle << "\n";
-              std::cout << packet.phase_on_each_bus << "\n";
-              std::cout << packet.power_flow_on_each_transmission_line << "\n";
-              std::cout << packet.substation_load << "\n";
-              std::cout << packet.substation_component_status << "\n";
-
-              std::cout << packet.time_stamp << "\n";
-            }
+          if (!storeReading(buf[FRAME_SOURCE], record))
+          {
+            std::cout << "Reading already stored" << std::endl;
+          }
+          else
+          {
+            Serial.print("Got broadcast from : 0x");
+            Serial.print(from);
+            Serial.print(": ");
+            Serial.println((char *)buf);
           }
         }
       }
-      // 30 second timer since last broadcast received, if surpassed check who was last broadcast from, check in map if its your turn after this broadcast
-      // go to state 1 and change other node to false, send changed node to other nodes
-      // if not turn do nothing and wait for other nodes to fix problem
-      else if (millis() - last_broadcast_received_timer >= last_broadcast_received)
-      {
-        if (prevNode(from, node_status_map))
-        {
-          state = 1;
-          printf("state 1\n");
-        }
-        last_broadcast_received_timer = millis();
-      }
-      if (send_turn && (millis() - wait_timer >= 25000))
-      {
-        send_turn = false;
-        printf("state 5\n");
-        state = 5;
-      }
     }
-    /*State 5: Node sends turn broadcast */
-    else if (state == 5) // send turn broadcast
+
+    /* No beacon heard: there is no network in range, so create one with this node as its only member and coordinator */
+    if (state == STATE_JOIN && !synced && millis() - joinListenStartTimer >= joinListenTimeout)
     {
-      sleep(2);
-      turn[10];
-      uint8_t turnlen = sizeof(turn);
-      turn[0] = NSK;
-      std::map<int, bool>::iterator itr;
-      printf("I will send the turn now\n");
-      if ((itr = node_status_map.find(NODE4_ADDRESS))->second == true)
-      {
-        turn[1] = NODE4_ADDRESS;
-        printf("node 3's turn\n");
-        if (manager.sendto(turn, turnlen, RH_BROADCAST_ADDRESS))
-        {
-          printf("sent turn\n");
-          state = 12;
-          rf95.setModeRx();
-        }
-      }
-      else if ((itr = node_status_map.find(NODE5_ADDRESS))->second == true)
-      {
-        turn[1] = NODE5_ADDRESS;
-        printf("node 4's turn\n");
-        if (manager.sendto(turn, turnlen, RH_BROADCAST_ADDRESS))
-        {
-          printf("sent turn\n");
-          state = 12;
-          rf95.setModeRx();
-        }
-      }
-      else if ((itr = node_status_map.find(NODE6_ADDRESS))->second == true)
-      {
-        turn[1] = NODE6_ADDRESS;
-        printf("node 5's turn\n");
-        if (manager.sendto(turn, turnlen, RH_BROADCAST_ADDRESS))
-        {
-          printf("sent turn\n");
-          state = 12;
-          rf95.setModeRx();
-        }
-      }
-      else if ((itr = node_status_map.find(NODE1_ADDRESS))->second == true)
-      {
-        turn[1] = NODE1_ADDRESS;
-        printf("node 6's turn\n");
-        if (manager.sendto(turn, turnlen, RH_BROADCAST_ADDRESS))
-        {
-          printf("sent turn\n");
-          state = 12;
-          rf95.setModeRx();
-        }
-      }
-      else if ((itr = node_status_map.find(NODE2_ADDRESS))->second == true)
-      {
-        turn[1] = NODE2_ADDRESS;
-        printf("node1 turn\n");
-        if (manager.sendto(turn, turnlen, RH_BROADCAST_ADDRESS))
-        {
-          printf("sent turn\n");
-          rf95.setModeRx();
-          state = 12;
-        }
-      }
-      else
-      {
-        printf("There's no one else in the network to send the turn to\n");
-        two_nodes = false;
-        state = 11; // you are the only node in the network. wait for a join req
-        rf95.setModeRx();
-      }
+      Roster self;
+      self.add(config.address);
+      schedule.setMembers(self);
+      state = STATE_MEMBER;
+      synced = true;
+      cycle = 0;
+      cycleStart = millis();
+      actionOffset = nextSlotAction(schedule, state, 0, &action);
+      armSlotTimer(cycleStart + actionOffset);
+      printf("Created network, cycle %u ms\n", schedule.cycleLength());
+    }
+
+    /* Slot actions: everything this node transmits, at its fixed offset in the cycle */
+    if (!synced || (long)(millis() - (cycleStart + actionOffset)) < 0)
+    {
+      continue;
+    }
+    // An action that is more than a guard time late would overlap the next slot, so it is skipped
+    bool late = millis() - (cycleStart + actionOffset) > TDMA_GUARD && action != SLOT_CYCLE_END;
 
-      // start retry turn timer
-      retry_turn_timer = millis();
-      // this node is the master node
-      master_node = true;
-      printf("tx %d\n", rf95.txGood());
-      last_broadcast_received_timer = millis();
+    if (late)
+    {
+      printf("Missed slot action %d\n", action);
     }
-    /*State 6: Node retries to send broadcast*/
-    else if (state == 6) // retry send
+    /*Beacon: the coordinator starts each cycle with the cycle number and member list */
+    else if (action == SLOT_BEACON)
     {
-      uint8_t datalen = sizeof(data);
-      if (manager.sendto(data, datalen, RH_BROADCAST_ADDRESS))
+      uint8_t beacon[TDMA_BEACON_LEN];
+      uint8_t beaconlen = schedule.encodeBeacon(beacon, cycle);
+      if (sendFrame(FRAME_KIND_BEACON, beacon, beaconlen))
       {
-        printf("Sending retry... \n");
-        // wait for packet to be sent
+        printf("Sending beacon, cycle %u, %d members\n", cycle, schedule.memberCount());
         rf95.waitPacketSent();
-        printf("waited \n");
         rf95.setModeRx();
-        state = 2;
       }
-      retryStartTimer = millis();
+      beaconHeard = true;
     }
-    /*State 7: Node sends a join request */
-    else if (state == 7) // join-send
+    /*Data: the node sends its reading, or resends it if the last slot was not acknowledged */
+    else if (action == SLOT_DATA && schedule.memberCount() > 1)
     {
-      // join request data
-      printf("Join request started\n");
-      uint8_t join[50];
-      uint8_t joinlen = sizeof(join);
-      join[0] = RH_FLAGS_JOIN_REQUEST; // Flag that indicates join request
-      join[1] = THIS_NODE_ADDRESS;
-
-      /*send a broadcast with a join request message and setting join request flag*/
-      manager.sendto(join, joinlen, RH_BROADCAST_ADDRESS);
-      rf95.waitPacketSent();
-      // change to join-recv state
-      state = 8;
-      joinResendStartTimer = millis();
-      printf("Join request ended\n");
-      printf("tx %d \n", rf95.txGood());
-    }
-    /*State 8: Node receives join request acknowledgement*/
-    else if (state == 8) // join-recv-ack
-    {
-      bool recvd = false;
-      // join-recv start time for 10 second timeout
-      if (manager.recvfrom(buf, &buflen, &from))
+      if (acked)
       {
-        printf("Join request acknowledgement receive started\n");
-
-        if ((int)buf[0] == RH_FLAGS_JOIN_REQUEST)
+        // Generates random data simulating the data from the substation
+        reading.timeStamp = (uint32_t)time(NULL);
+        reading.phaseAngle = 1 + (rand() % 91);
+        reading.busPhase = 1 + (rand() % 101);
+        reading.powerFlow = 1 + (rand() % 101);
+        reading.load = 1 + (rand() % 101);
+        reading.status = (rand() % 2) != 0;
+
+        std::cout << "Message to encrypt:" << std::endl;
+        printf("%u %u %u %u %d %u\n", reading.phaseAngle, reading.busPhase, reading.powerFlow, reading.load, reading.status, reading.timeStamp);
+
+        // Encode the reading as a binary record and seal it into an AES-CCM frame under a fresh sequence number
+        uint8_t record[TELEMETRY_RECORD_MAX_LEN];
+        uint8_t recordLen = TelemetryEncode(&reading, record);
+        txSequence++;
+        if (txSequence >= txReserved)
         {
-          printf("Received join request acknowledgement\n");
-          printf((char *)buf);
-
-          std::map<int, bool>::iterator itr;
-          for (int i = 1; i <= buflen; i++)
+          txReserved = txSequence + SEQUENCE_RESERVE;
+          if (!saveSequenceReserve(sequenceFile, txReserved))
           {
-            printf("id %d\n", (int)buf[i]);
-            itr = node_status_map.find((int)buf[i]);
-            itr->second = true;
-
-            if (buf[i] == '\0')
-            {
-              itr = node_status_map.find(THIS_NODE_ADDRESS);
-              itr->second = true;
-              printf("break null\n");
-              break;
-            }
+            printf("Sequence reserve could not be saved in %s\n", sequenceFile.c_str());
           }
-          rf95.waitAvailableTimeout(2000);
-          retry = 0;
-          recvd = true;
         }
-      }
-      // if ive sent join-send more than 7 times create nertwork
-      if (retry > 2)
-      {
-        // change to create new network state
-        state = 10;
-        retry = 0;
-      }
-      else if (recvd)
-      {
-        printf("going to state 4\n");
-        state = 4;
-        recvd = false;
-        last_broadcast_received_timer = millis();
-      }
-      // wait 10 seconds to receive join request ack
-      // if no ack received switch back to join-send state
-      else if (millis() - joinResendStartTimer >= joinResendTimer)
-      {
-        state = 7;
-        retry++;
-        printf("retry join send\n");
-      }
-    }
-    /*State 9: Node sends join request acknowledgement */
-    else if (state == 9) // join-send-ack
-    {
-      printf("Sending join request acknowdledgement...\n");
-      uint8_t data[50];
-      std::map<int, bool>::iterator itr;
-      int i = 2;
-      data[0] = RH_FLAGS_JOIN_REQUEST;
-      data[1] = _from;
-      printf("%d\n", _from);
-      for (itr = node_status_map.begin(); itr != node_status_map.end(); ++itr)
-      {
-        if (itr->second == true)
+        datalen = sealFrame(data, config.address, txSequence, record, recordLen, &keySchedule);
+        acked = false;
+
+        // Prints the sealed frame in hex form
+        std::cout << "Encrypted frame in hex:" << std::endl;
+        for (int i = 0; i < datalen; i++)
         {
-          data[i] = itr->first;
-          i++;
+          std::cout << std::hex << (int)data[i];
+          std::cout << " ";
         }
+
+        std::cout << std::endl;
       }
-      Serial.println((char *)buf);
-      uint8_t datalen = sizeof(data);
-      srand((unsigned)rand());
-      // random delay so not all nodes send an acknowledgement at the same time
-      int sleepTime = 0 + (rand() % 6);
-      sleep(sleepTime);
-      printf("rand %d \n", sleepTime);
-      manager.sendto(data, datalen, RH_BROADCAST_ADDRESS);
-      rf95.waitPacketSent(2000);
-      printf("waited\n");
-      state = 4;
-      rf95.setModeRx();
-      if (two_nodes)
-      {
-        state = 5;
-        two_nodes = false;
-        rf95.setModeTx();
-        sleep(5);
-      }
-      itr = node_status_map.find(_from);
-      if (itr != node_status_map.end())
+
+      if (sendFrame(FRAME_KIND_DATA, data, datalen))
       {
-        itr->second = true;
+        printf("size %d\n", datalen);
+        printf("Sending broadcast in slot %d... \n", schedule.slotOf(config.address));
+        rf95.waitPacketSent();
+        rf95.setModeRx();
       }
-      printf("Sent join request acknowledgement\n");
     }
-    /*State 10: Node creates the network */
-    else if (state == 10) // create new network
+    /*Relay: the node repeats the last frame it heard, so nodes out of range of its source get it.
+    Relayed frames are not acknowledged or relayed again. With two nodes there is no one else to reach. */
+    else if (action == SLOT_RELAY && dupe_buflen > 0 && schedule.memberCount() > 2)
     {
-      NSK = random(1000, 9999);
-      // go to recv state, wait for a join request
-      state = 11;
-      std::map<int, bool>::iterator itr;
-      itr = node_status_map.find(THIS_NODE_ADDRESS);
-      if (itr != node_status_map.end())
+      if (sendFrame(FRAME_KIND_RELAY, dupe_buf, dupe_buflen))
       {
-        itr->second = true;
+        printf("Relaying broadcast from %d\n", (int)dupe_buf[FRAME_SOURCE]);
+        rf95.waitPacketSent();
+        rf95.setModeRx();
       }
-      printf("Created network\n");
+      dupe_buflen = 0;
     }
-    /*State 11: Node receives join request*/
-    else if (state == 11)
+    /*Join: a node that is not a member asks the coordinator to add it. Half the time, so joining nodes don't collide forever */
+    else if (action == SLOT_JOIN && (rand() % 2) == 0)
     {
-      if (manager.recvfrom(buf, &buflen, &from))
+      if (sendFrame(FRAME_KIND_JOIN_REQUEST, NULL, JOIN_FRAME_LEN))
       {
-        printf("recv node join req send join ack start\n");
-        if ((int)buf[0] == RH_FLAGS_JOIN_REQUEST)
-        {
-          rf95.waitAvailableTimeout(2000);
-          _from = from;
-          state = 9;
-          two_nodes = true;
-        }
-        printf("recv node join req send join ack end\n");
+        printf("Sending join request\n");
+        rf95.waitPacketSent();
+        rf95.setModeRx();
       }
     }
-    /*State 12: Node receives turn acknowledgement */
-    else if (state == 12) // receive turn acknowledgement
+    /*Cycle end: membership only changes between cycles, so every node uses the same table for a whole cycle */
+    else if (action == SLOT_CYCLE_END)
     {
-      if (manager.recvfrom(buf, &buflen, &from))
-      {
-        printf("recvd something\n");
-        if (master_node && ((int)buf[0] == RH_FLAGS_ACK || from == (int)turn[1]))
-        {
-          printf("recv node turn ack start\n");
-          rf95.waitAvailableTimeout(2000);
-          //_from = from;
-          state = 4;
-          printf("go to state 4\n");
-          master_node = false;
-        }
-      }
-      else if (turn_retry >= 3) // after 3 retries change node to false and send to next node
+      cycleStart += schedule.cycleLength();
+      cycle++;
+
+      if (state == STATE_MEMBER && schedule.coordinator() == config.address)
       {
-        bool none = true;
-        printf("retry counter\n");
-        std::map<int, bool>::iterator itr;
-        itr = node_status_map.find(THIS_NODE_ADDRESS);
-        while (itr != node_status_map.end())
+        // Admit the nodes that asked to join and drop members that have been silent too long
+        for (uint8_t i = 0; i < pendingJoins.count(); i++)
         {
-          itr++;
-          std::cout << itr->first << " :: " << itr->second << std::endl;
-          printf(" while 2");
-          if (itr->second == true)
+          if (schedule.addMember(pendingJoins.at(i)))
           {
-            itr->second = false;
-            none = false;
-            break;
+            printf("Node %d joined the network\n", pendingJoins.at(i));
+            lastHeard[pendingJoins.at(i)] = cycle;
           }
         }
-        if (none)
+        pendingJoins.clear();
+        for (int i = schedule.memberCount() - 1; i >= 0; i--)
         {
-          for (itr = node_status_map.begin(); itr != node_status_map.end(); itr++)
+          uint8_t member = schedule.member(i);
+          if (member != config.address && cycle - lastHeard[member] > TDMA_MEMBER_TIMEOUT)
           {
-            std::cout << itr->first << " :: " << itr->second << std::endl;
-            printf(" for 2");
-            if (itr->second == true)
-            {
-              if (itr != node_status_map.find(THIS_NODE_ADDRESS))
-              {
-                itr->second = false;
-              }
-              break;
-            }
+            printf("Node %d is silent, dropped from the network\n", member);
+            schedule.removeMember(member);
           }
         }
-        printf("state 5\n");
-        state = 5;
-        turn_retry = 0;
-      }
-      else if (millis() - retry_turn_timer >= retry_turn_timeout) // after x seconds resend turn msg
-      {
-        // start timer after sending turn
-        printf("retry timer %ld\n", retry_turn_timer);
-        state = 5;
-        turn_retry++;
       }
-      // sleep(4);
-    }
-    /*State 13: Node sends received data*/
-    else if (state == 13) // rebroadcast received data
-    {
-      printf("state 13:I will attempt to rebroadcast my saved data\n");
-      sleep(2);
-      if (!two_nodes)
+      else if (!beaconHeard && ++missedBeacons >= TDMA_BEACON_LOSS)
       {
-        if (manager.sendto(dupe_buf, dupe_buflen, RH_BROADCAST_ADDRESS))
+        // The coordinator is gone. Every member drops it at the same cycle and the next lowest address takes over.
+        printf("No beacon from %d for %d cycles, dropped from the network\n", schedule.coordinator(), missedBeacons);
+        schedule.removeMember(schedule.coordinator());
+        missedBeacons = 0;
+        if (schedule.memberCount() == 0)
         {
-          printf("Sending broadcast... \n");
-          rf95.waitPacketSent();
-          printf("waited \n");
-          rf95.setModeRx();
-          state = 4;
-          printf("state 4\n");
+          synced = false;
+          joinListenStartTimer = millis();
+          eventLoop.arm(TIMER_JOIN_LISTEN, joinListenTimeout);
         }
       }
-      if (master_node)
-      {
-        send_turn = true;
-        wait_timer = millis();
-      }
-      if (new_node)
-      {
-        state = 14;
-        printf("state 14\n");
-      }
-      sleep(2);
-      printf("state 13 end: I finished brodcasting my data\n");
-      wait_timer = millis();
+      beaconHeard = false;
+      actionOffset = 0;
     }
-    /*State 14: Node notifies other nodes that there is a new node in the network */
-    else if (state == 14) // sending new node
+
+    if (synced)
     {
-      printf("state 14 start\n");
-      sleep(3);
-      uint8_t new_node_arr[20];
-      uint8_t new_node_arrlen = sizeof(new_node_arr);
-      new_node_arr[0] = RH_FLAGS_JOIN_REQUEST;
-      new_node_arr[2] = new_node_id;
-      if (manager.sendto(new_node_arr, new_node_arrlen, RH_BROADCAST_ADDRESS))
-      {
-        printf((char *)&new_node_arr);
-        printf("Sending new node... \n");
-        rf95.waitPacketSent();
-        printf("waited \n");
-        rf95.setModeRx();
-      }
-      new_node = false;
-      printf("got to 4\n");
-      state = 4;
-      printf("state 14 end\n");
-      wait_timer = millis();
+      actionOffset = nextSlotAction(schedule, state, actionOffset, &action);
+      armSlotTimer(cycleStart + actionOffset);
     }
   }
+  // Drains the queue and closes the store
+  storageWriter.stop();
+  dedup.save();
   printf("\n Test has ended \n");
   gpioTerminate();
   return 0;
@@ -1545,4 +1262,12 @@ int main(int argc, const char *argv[])
 void sig_handler(int sig)
 {
   flag = 1;
-}
\ No newline at end of file
+  eventLoop.notifyStop();
+}
+
+// Runs on the pigpio ISR thread after RH_RF95 has handled DIO0
+void radio_interrupt(unsigned char pin)
+{
+  (void)pin;
+  eventLoop.notifyRadio();
+}
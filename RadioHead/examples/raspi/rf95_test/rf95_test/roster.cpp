@@ -0,0 +1,66 @@
+/* "roster.cpp" implements the membership roster declared in roster.h.
+ */
+#include "roster.h"
+
+#include <string.h>
+
+Roster::Roster()
+{
+  clear();
+}
+
+void Roster::clear()
+{
+  memset(_bitmap, 0, sizeof(_bitmap));
+  rebuild();
+}
+
+bool Roster::add(uint8_t address)
+{
+  if (address < ROSTER_MIN_ADDRESS || address > ROSTER_MAX_ADDRESS || contains(address))
+  {
+    return false;
+  }
+  _bitmap[address >> 3] |= 1 << (address & 7);
+  rebuild();
+  return true;
+}
+
+bool Roster::remove(uint8_t address)
+{
+  if (!contains(address))
+  {
+    return false;
+  }
+  _bitmap[address >> 3] &= ~(1 << (address & 7));
+  rebuild();
+  return true;
+}
+
+void Roster::setBitmap(const uint8_t *bitmap)
+{
+  memcpy(_bitmap, bitmap, sizeof(_bitmap));
+  // Address 0 and the broadcast address are never members
+  _bitmap[0] &= ~1;
+  _bitmap[ROSTER_BITMAP_LEN - 1] &= ~0x80;
+  rebuild();
+}
+
+// Walks the bitmap in address order to lay out the ring again
+void Roster::rebuild()
+{
+  _count = 0;
+  for (int address = ROSTER_MIN_ADDRESS; address <= ROSTER_MAX_ADDRESS; address++)
+  {
+    if (contains(address))
+    {
+      _index[address] = _count;
+      _order[_count++] = address;
+    }
+  }
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    _next[_order[i]] = _order[(i + 1) % _count];
+    _prev[_order[i]] = _order[(i + _count - 1) % _count];
+  }
+}
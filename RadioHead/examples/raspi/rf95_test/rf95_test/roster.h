@@ -0,0 +1,62 @@
+/* "roster.h" declares the set of node addresses in the network.
+ * Membership is a bitset over addresses 1..254, the same bitmap the beacon carries.
+ * Beside it the roster keeps the members in address order as a ring, with each
+ * member's index, successor and predecessor, so lookups are O(1). Adding or removing
+ * a member rebuilds the ring from the bitmap, which only happens on joins and drops.
+ */
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <stdint.h>
+
+// Lowest and highest node address. 0 is unset and 255 is RH_BROADCAST_ADDRESS.
+#define ROSTER_MIN_ADDRESS 1
+#define ROSTER_MAX_ADDRESS 254
+#define ROSTER_MAX_MEMBERS (ROSTER_MAX_ADDRESS - ROSTER_MIN_ADDRESS + 1)
+// Bytes in the membership bitmap, bit n of byte n / 8 is address n
+#define ROSTER_BITMAP_LEN 32
+
+class Roster
+{
+public:
+  Roster();
+
+  // Removes every member
+  void clear();
+
+  // Adds or removes address. Return false if nothing changed or address is out of range.
+  bool add(uint8_t address);
+  bool remove(uint8_t address);
+
+  bool contains(uint8_t address) const
+  {
+    return address >= ROSTER_MIN_ADDRESS && address <= ROSTER_MAX_ADDRESS && (_bitmap[address >> 3] & (1 << (address & 7)));
+  }
+  uint8_t count() const { return _count; }
+  // Member at index in address order
+  uint8_t at(uint8_t index) const { return _order[index]; }
+  // Index of address in address order, or -1 if it is not a member
+  int indexOf(uint8_t address) const { return contains(address) ? _index[address] : -1; }
+  // Lowest member address, or 0 if there are no members
+  uint8_t first() const { return _count > 0 ? _order[0] : 0; }
+  // Member after or before address in address order, wrapping round. 0 if address is not a member.
+  uint8_t successor(uint8_t address) const { return contains(address) ? _next[address] : 0; }
+  uint8_t predecessor(uint8_t address) const { return contains(address) ? _prev[address] : 0; }
+
+  // The membership bitmap, ROSTER_BITMAP_LEN bytes
+  const uint8_t *bitmap() const { return _bitmap; }
+  // Replaces the members with the ones set in bitmap. Bits for 0 and 255 are ignored.
+  void setBitmap(const uint8_t *bitmap);
+
+private:
+  void rebuild();
+
+  uint8_t _bitmap[ROSTER_BITMAP_LEN];
+  uint8_t _order[ROSTER_MAX_MEMBERS];
+  uint8_t _index[256];
+  uint8_t _next[256];
+  uint8_t _prev[256];
+  uint8_t _count;
+};
+
+#endif /* ROSTER_H */
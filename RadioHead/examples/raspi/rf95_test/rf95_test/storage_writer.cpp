@@ -0,0 +1,135 @@
+/* "storage_writer.cpp" implements the storage thread declared in storage_writer.h.
+ * _head and _tail count records forever and are masked into the ring, so
+ * _head - _tail is the depth even after they wrap.
+ */
+#include "storage_writer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+StorageWriter::StorageWriter()
+    : _head(0), _tail(0), _highWater(0), _written(0), _dropped(0), _failed(0), _stopping(false),
+      _running(false), _store(NULL), _onWritten(NULL)
+{
+  sem_init(&_wake, 0, 0);
+}
+
+StorageWriter::~StorageWriter()
+{
+  stop();
+  sem_destroy(&_wake);
+}
+
+unsigned long StorageWriter::nowMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool StorageWriter::start(RecordStore *store, WrittenCallback onWritten)
+{
+  _store = store;
+  _onWritten = onWritten;
+  _stopping = false;
+  if (pthread_create(&_thread, NULL, threadMain, this) != 0)
+  {
+    return false;
+  }
+  _running = true;
+  return true;
+}
+
+bool StorageWriter::push(const StoredRecord &record)
+{
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  uint32_t depth = head - _tail.load(std::memory_order_acquire);
+
+  if (depth >= STORAGE_WRITER_QUEUE_LEN)
+  {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  _ring[head & (STORAGE_WRITER_QUEUE_LEN - 1)] = record;
+  _head.store(head + 1, std::memory_order_release);
+
+  if (depth + 1 > _highWater.load(std::memory_order_relaxed))
+  {
+    _highWater.store(depth + 1, std::memory_order_relaxed);
+  }
+  sem_post(&_wake);
+  return true;
+}
+
+uint32_t StorageWriter::depth() const
+{
+  return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+}
+
+void StorageWriter::stop()
+{
+  if (!_running)
+  {
+    return;
+  }
+  _stopping = true;
+  sem_post(&_wake);
+  pthread_join(_thread, NULL);
+  _running = false;
+}
+
+void *StorageWriter::threadMain(void *arg)
+{
+  ((StorageWriter *)arg)->run();
+  return NULL;
+}
+
+void StorageWriter::run()
+{
+  for (;;)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t head = _head.load(std::memory_order_acquire);
+
+    // Hand everything queued to the store, which batches it into as few writes as it can
+    while (tail != head)
+    {
+      const StoredRecord &record = _ring[tail & (STORAGE_WRITER_QUEUE_LEN - 1)];
+      if (!_store->append(record, nowMs()))
+      {
+        _failed.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (_onWritten != NULL)
+      {
+        _onWritten(record);
+      }
+      tail++;
+      _tail.store(tail, std::memory_order_release);
+      _written.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _store->poll(nowMs());
+
+    if (_stopping && _tail.load(std::memory_order_relaxed) == _head.load(std::memory_order_acquire))
+    {
+      break;
+    }
+
+    // Sleep until a record is pushed, or long enough for the store's flush and sync timers
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += STORAGE_WRITER_IDLE_WAIT / 1000;
+    until.tv_nsec += (STORAGE_WRITER_IDLE_WAIT % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L)
+    {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    while (sem_timedwait(&_wake, &until) != 0 && errno == EINTR)
+    {
+    }
+  }
+
+  _store->close();
+}
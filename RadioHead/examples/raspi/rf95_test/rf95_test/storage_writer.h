@@ -0,0 +1,77 @@
+/* "storage_writer.h" declares the thread that owns the RecordStore.
+ * The radio loop pushes records into a bounded single producer, single consumer ring and
+ * returns at once. The writer thread drains the ring into the store, so a slow write or
+ * fsync never holds up an acknowledgement or a turn timer. A full ring drops the record
+ * and counts it rather than blocking the radio.
+ */
+#ifndef STORAGE_WRITER_H
+#define STORAGE_WRITER_H
+
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+
+#include "record_store.h"
+
+// Records the ring can hold, a power of two
+#define STORAGE_WRITER_QUEUE_LEN 256
+// ms the writer sleeps when idle before it lets the store flush and sync on its timers
+#define STORAGE_WRITER_IDLE_WAIT 1000
+
+class StorageWriter
+{
+public:
+  // Called on the writer thread after each record is handed to the store
+  typedef void (*WrittenCallback)(const StoredRecord &record);
+
+  StorageWriter();
+  ~StorageWriter();
+
+  /* Starts the writer thread on an opened store. onWritten may be NULL.
+   * Returns false if the thread could not be created.
+   */
+  bool start(RecordStore *store, WrittenCallback onWritten);
+
+  /* Queues a record for the writer. Never blocks; returns false and counts a drop
+   * if the ring is full. Must only be called from one thread.
+   */
+  bool push(const StoredRecord &record);
+
+  // Drains the ring, closes the store and joins the thread
+  void stop();
+
+  // Records waiting in the ring
+  uint32_t depth() const;
+  // Largest depth seen since start
+  uint32_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+  // Records handed to the store
+  unsigned long written() const { return _written.load(std::memory_order_relaxed); }
+  // Records dropped because the ring was full
+  unsigned long dropped() const { return _dropped.load(std::memory_order_relaxed); }
+  // Records the store failed to write
+  unsigned long failed() const { return _failed.load(std::memory_order_relaxed); }
+
+private:
+  static void *threadMain(void *arg);
+  void run();
+  static unsigned long nowMs();
+
+  StoredRecord _ring[STORAGE_WRITER_QUEUE_LEN];
+  // Next slot the radio writes, only advanced by push()
+  std::atomic<uint32_t> _head;
+  // Next slot the writer reads, only advanced by the writer thread
+  std::atomic<uint32_t> _tail;
+  std::atomic<uint32_t> _highWater;
+  std::atomic<unsigned long> _written;
+  std::atomic<unsigned long> _dropped;
+  std::atomic<unsigned long> _failed;
+  std::atomic<bool> _stopping;
+  sem_t _wake;
+  pthread_t _thread;
+  bool _running;
+  RecordStore *_store;
+  WrittenCallback _onWritten;
+};
+
+#endif /* STORAGE_WRITER_H */
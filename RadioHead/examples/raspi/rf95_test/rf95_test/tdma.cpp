@@ -0,0 +1,97 @@
+/* "tdma.cpp" implements the slot schedule declared in tdma.h.
+ */
+#include "tdma.h"
+
+#include <string.h>
+
+TdmaSchedule::TdmaSchedule()
+    : _airtime(0), _dataLen(0), _ackLen(0), _joinLen(0), _beaconSlot(0), _memberSlot(0), _joinSlot(0), _relayOffset(0)
+{
+}
+
+void TdmaSchedule::setFrames(AirtimeFunction airtime, uint8_t dataLen, uint8_t ackLen, uint8_t joinLen)
+{
+  _airtime = airtime;
+  _dataLen = dataLen;
+  _ackLen = ackLen;
+  _joinLen = joinLen;
+  recompute();
+}
+
+void TdmaSchedule::setMembers(const Roster &members)
+{
+  _members = members;
+  recompute();
+}
+
+bool TdmaSchedule::addMember(uint8_t address)
+{
+  if (!_members.add(address))
+  {
+    return false;
+  }
+  recompute();
+  return true;
+}
+
+bool TdmaSchedule::removeMember(uint8_t address)
+{
+  if (!_members.remove(address))
+  {
+    return false;
+  }
+  recompute();
+  return true;
+}
+
+uint32_t TdmaSchedule::cycleLength(uint8_t count) const
+{
+  return _beaconSlot + count * _memberSlot + _joinSlot;
+}
+
+uint32_t TdmaSchedule::beaconAirtime() const
+{
+  return _airtime ? _airtime(TDMA_BEACON_LEN) : 0;
+}
+
+void TdmaSchedule::recompute()
+{
+  if (!_airtime)
+  {
+    return;
+  }
+  uint32_t data = _airtime(_dataLen);
+  uint32_t ack = _airtime(_ackLen);
+
+  _beaconSlot = TDMA_GUARD + beaconAirtime() + TDMA_GUARD;
+  _relayOffset = TDMA_GUARD + data + TDMA_GUARD + ack + TDMA_GUARD;
+  _memberSlot = _relayOffset + data + TDMA_GUARD;
+  _joinSlot = TDMA_GUARD + _airtime(_joinLen) + TDMA_GUARD;
+}
+
+uint8_t TdmaSchedule::encodeBeacon(uint8_t *out, uint32_t cycle) const
+{
+  out[0] = coordinator();
+  out[1] = cycle >> 24;
+  out[2] = cycle >> 16;
+  out[3] = cycle >> 8;
+  out[4] = cycle;
+  memcpy(out + TDMA_BEACON_HEADER_LEN, _members.bitmap(), ROSTER_BITMAP_LEN);
+  return TDMA_BEACON_LEN;
+}
+
+bool TdmaSchedule::decodeBeacon(const uint8_t *in, uint8_t len, uint8_t *coordinator, uint32_t *cycle, Roster *members)
+{
+  if (len != TDMA_BEACON_LEN)
+  {
+    return false;
+  }
+  members->setBitmap(in + TDMA_BEACON_HEADER_LEN);
+  if (members->count() == 0)
+  {
+    return false;
+  }
+  *coordinator = in[0];
+  *cycle = ((uint32_t)in[1] << 24) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 8) | in[4];
+  return true;
+}
@@ -0,0 +1,94 @@
+/* "tdma.h" declares the slot schedule that replaces passing a turn token around the network.
+ * A cycle is a beacon slot, one slot per member in address order, then a join slot:
+ *
+ *   | beacon | member 0 | member 1 | ... | member n-1 | join |
+ *
+ * The lowest member address is the coordinator and sends the beacon, which carries the
+ * cycle number and the roster bitmap so every node derives the same table.
+ * Within a member slot the owner sends its data frame, its successor acknowledges it,
+ * then the owner may relay one frame it heard from another node:
+ *
+ *   | guard | data | ack window | relay | guard |
+ *
+ * Slot lengths come from the time on air of the largest frame of each kind, as the radio
+ * driver reports it for the current modem config, so a faster config shrinks every slot.
+ */
+#ifndef TDMA_H
+#define TDMA_H
+
+#include <stdint.h>
+#include "roster.h"
+
+// ms of slack at each end of a slot and around the ack, for clock error and scheduling latency
+#define TDMA_GUARD 100
+// Beacon frame: [0] coordinator, [1..4] cycle number, then the roster bitmap. Its flag goes in the radio header.
+#define TDMA_BEACON_HEADER_LEN 5
+#define TDMA_BEACON_LEN (TDMA_BEACON_HEADER_LEN + ROSTER_BITMAP_LEN)
+
+class TdmaSchedule
+{
+public:
+  // Returns the time on air in ms of a frame with len bytes of application payload
+  typedef uint32_t (*AirtimeFunction)(uint8_t len);
+
+  TdmaSchedule();
+
+  /* Sets the airtime function and the largest data, ack and join frames.
+   * Slot lengths are recomputed from them.
+   */
+  void setFrames(AirtimeFunction airtime, uint8_t dataLen, uint8_t ackLen, uint8_t joinLen);
+
+  // Replaces the members. Slots follow address order.
+  void setMembers(const Roster &members);
+  // Adds or removes one member. Return false if nothing changed.
+  bool addMember(uint8_t address);
+  bool removeMember(uint8_t address);
+
+  const Roster &members() const { return _members; }
+  uint8_t memberCount() const { return _members.count(); }
+  uint8_t member(uint8_t slot) const { return _members.at(slot); }
+  // Slot index of address, or -1 if it is not a member
+  int slotOf(uint8_t address) const { return _members.indexOf(address); }
+  // Member that sends the beacon: the lowest address, or 0 if there are no members
+  uint8_t coordinator() const { return _members.first(); }
+  // Member after or before address in slot order, wrapping round. 0 if address is alone or not a member.
+  uint8_t successor(uint8_t address) const { return memberCount() > 1 ? _members.successor(address) : 0; }
+  uint8_t predecessor(uint8_t address) const { return memberCount() > 1 ? _members.predecessor(address) : 0; }
+
+  // Lengths in ms
+  uint32_t beaconSlotLength() const { return _beaconSlot; }
+  uint32_t memberSlotLength() const { return _memberSlot; }
+  uint32_t joinSlotLength() const { return _joinSlot; }
+  uint32_t cycleLength() const { return cycleLength(memberCount()); }
+  // Length of a cycle with count members, for waiting out a cycle of a network not heard yet
+  uint32_t cycleLength(uint8_t count) const;
+
+  // Offset from the cycle start to the start of member slot
+  uint32_t memberSlotOffset(uint8_t slot) const { return _beaconSlot + slot * _memberSlot; }
+  // Offset from the cycle start to the start of the join slot
+  uint32_t joinSlotOffset() const { return memberSlotOffset(memberCount()); }
+  // Offset from a member slot start to the relay frame
+  uint32_t relayOffset() const { return _relayOffset; }
+  // Time on air of a beacon, for aligning to a received one
+  uint32_t beaconAirtime() const;
+
+  // Writes the beacon for cycle and returns its length, TDMA_BEACON_LEN
+  uint8_t encodeBeacon(uint8_t *out, uint32_t cycle) const;
+  // Reads a beacon. Returns false if the frame has the wrong length or no members.
+  static bool decodeBeacon(const uint8_t *in, uint8_t len, uint8_t *coordinator, uint32_t *cycle, Roster *members);
+
+private:
+  void recompute();
+
+  AirtimeFunction _airtime;
+  uint8_t _dataLen;
+  uint8_t _ackLen;
+  uint8_t _joinLen;
+  Roster _members;
+  uint32_t _beaconSlot;
+  uint32_t _memberSlot;
+  uint32_t _joinSlot;
+  uint32_t _relayOffset;
+};
+
+#endif /* TDMA_H */
@@ -0,0 +1,85 @@
+/* "telemetry.cpp" implements the record encoding declared in telemetry.h.
+ * Byte 0: version in bits 7..4, component status in bit 0.
+ * Bytes 1..4: timestamp, big endian.
+ * Then phase angle, bus phase, power flow and load as 7 bit varints, low bits first.
+ */
+#include "telemetry.h"
+
+// Status bit in the header byte
+#define TELEMETRY_STATUS_BIT 0x01
+
+// Appends value as a varint and returns the number of bytes written
+static uint8_t putVarint(uint8_t *out, uint16_t value)
+{
+  uint8_t n = 0;
+
+  while (value >= 0x80)
+  {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+// Reads a varint of at most 2 bytes at in[*offset]. Returns false if it runs past len.
+static bool getVarint(const uint8_t *in, uint8_t len, uint8_t *offset, uint16_t *value)
+{
+  *value = 0;
+  for (uint8_t shift = 0; shift < 14; shift += 7)
+  {
+    if (*offset >= len)
+    {
+      return false;
+    }
+    uint8_t b = in[(*offset)++];
+    *value |= (uint16_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t TelemetryEncode(const TelemetryRecord *record, uint8_t *out)
+{
+  uint8_t n = 0;
+
+  if (record->phaseAngle > TELEMETRY_FIELD_MAX || record->busPhase > TELEMETRY_FIELD_MAX ||
+      record->powerFlow > TELEMETRY_FIELD_MAX || record->load > TELEMETRY_FIELD_MAX)
+  {
+    return 0;
+  }
+
+  out[n++] = (TELEMETRY_VERSION << 4) | (record->status ? TELEMETRY_STATUS_BIT : 0);
+  out[n++] = record->timeStamp >> 24;
+  out[n++] = record->timeStamp >> 16;
+  out[n++] = record->timeStamp >> 8;
+  out[n++] = record->timeStamp;
+  n += putVarint(out + n, record->phaseAngle);
+  n += putVarint(out + n, record->busPhase);
+  n += putVarint(out + n, record->powerFlow);
+  n += putVarint(out + n, record->load);
+
+  return n;
+}
+
+bool TelemetryDecode(const uint8_t *in, uint8_t len, TelemetryRecord *record)
+{
+  uint8_t offset = 5;
+
+  if (len < TELEMETRY_RECORD_MIN_LEN || (in[0] >> 4) != TELEMETRY_VERSION)
+  {
+    return false;
+  }
+
+  record->status = (in[0] & TELEMETRY_STATUS_BIT) != 0;
+  record->timeStamp = ((uint32_t)in[1] << 24) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 8) | in[4];
+
+  return getVarint(in, len, &offset, &record->phaseAngle) &&
+         getVarint(in, len, &offset, &record->busPhase) &&
+         getVarint(in, len, &offset, &record->powerFlow) &&
+         getVarint(in, len, &offset, &record->load) &&
+         offset == len;
+}
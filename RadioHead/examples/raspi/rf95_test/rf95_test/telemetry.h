@@ -0,0 +1,46 @@
+/* "telemetry.h" declares the binary record that carries one substation reading.
+ * The record replaces the ASCII timestamp in the payload so a reading fits in a single
+ * AES block: a version/status byte, the epoch seconds and four varint encoded fields.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+// Record format version, kept in the high nibble of the first byte
+#define TELEMETRY_VERSION 1
+// Largest encoded record: header, 4 byte timestamp and four 2 byte varints
+#define TELEMETRY_RECORD_MAX_LEN 13
+// Smallest encoded record: header, timestamp and four 1 byte varints
+#define TELEMETRY_RECORD_MIN_LEN 9
+// Largest value a field can carry, so its varint never exceeds 2 bytes
+#define TELEMETRY_FIELD_MAX 0x3fff
+
+// One substation reading
+struct TelemetryRecord
+{
+  // Seconds since the epoch when the reading was taken
+  uint32_t timeStamp;
+  // Phase angle, degrees
+  uint16_t phaseAngle;
+  // Phase on each bus, kW
+  uint16_t busPhase;
+  // Power flow on each transmission line, MW
+  uint16_t powerFlow;
+  // Substation load, kW
+  uint16_t load;
+  // Substation component status
+  bool status;
+};
+
+/* Encodes record into out, which must hold TELEMETRY_RECORD_MAX_LEN bytes.
+ * Returns the encoded length, or 0 if a field is larger than TELEMETRY_FIELD_MAX.
+ */
+uint8_t TelemetryEncode(const TelemetryRecord *record, uint8_t *out);
+
+/* Decodes len bytes from in into record.
+ * Returns false if the version is unknown or the record is truncated or has trailing bytes.
+ */
+bool TelemetryDecode(const uint8_t *in, uint8_t len, TelemetryRecord *record);
+
+#endif /* TELEMETRY_H */